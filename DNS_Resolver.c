@@ -48,15 +48,81 @@ Skeleton of code based on provided lookup.c file
 #include <pthread.h>
 #include <errno.h>
 #include <unistd.h>
+#include <math.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/time.h>
  
 #include "util.h"
 #include "multi-lookup.h"
+#include "breakdown.h"
+#include "memstats.h"
  
 #define MINARGS 3
-#define USAGE "<inputFilePath> <outputFilePath>"
+#define USAGE "[-d <deadline ms>] [-p <hedge percentile>] <inputFilePath> <outputFilePath>\n %s [-d <deadline ms>] [-p <hedge percentile>] --daemon [unix:<socketPath>]"
 #define INPUTFS "%1024s"
 
+// Hedging only kicks in once we've seen enough lookups for the percentile to mean something
+#define MIN_HEDGE_SAMPLES 20
+
+// Deadline/hedging settings and latency statistics; see multi-lookup.h for why this isn't in shared_variables
+struct lookup_stats stats;
+
+// One lookup and the (up to two) attempt threads working on it
+// Whoever lets go of it last (the resolver, or an attempt thread that finishes after the deadline) frees it
+struct lookup_group
+{
+    pthread_mutex_t lock;
+    pthread_cond_t answered;                                 // Signalled when the first attempt to finish fills in ip
+    int refs;                                                // Resolver + running attempts still holding this group
+    int done;                                                // An attempt has answered
+    int winner;                                              // Which attempt answered first (1 or 2)
+    int status;                                              // dnslookup return value of the winning attempt
+    char hostname[MAX_NAME_LENGTH];
+    char ip[INET6_ADDRSTRLEN];
+    struct timespec start;                                   // When the first attempt was started
+};
+
+// Argument for an attempt thread
+struct lookup_attempt_arg
+{
+    struct lookup_group *group;
+    int attempt;
+};
+
+// Function to add one hostname to the bounded buffer, blocking while the buffer is full
+// client is where the answer should go in daemon mode, or NULL for the output file in batch mode
+// Blocking here is the daemon's backpressure: a requester stuck waiting for space stops reading from its client
+void buffer_put (struct shared_variables *sv, const char *hostname, struct daemon_client *client)
+{
+    // Try to get lock for the buffer
+    pthread_mutex_lock (&sv->buffer);
+
+    // Check to make sure buffer is not full; if it is, wait until it isn't
+    while (sv->count >= MAX_INPUT_FILES)
+    {
+        // Wait until signal is received buffer has space for more names
+        // This conditional wait was taken from Assignment 6 code
+        pthread_cond_wait (&sv->not_full, &sv->buffer);
+    }
+
+    // Copy strings into buffer, use head pointer as it's the first free spot
+    strcpy (sv->shared_buffer [sv->head], hostname);
+    sv->shared_client [sv->head] = client;
+    // Set head pointer to the next available spot; if it's outside the buffer wraparound to the beginning
+    sv->head = (++(sv->head) % MAX_INPUT_FILES);
+
+    // Iterate count by 1 to reflect buffer now has one more address
+    sv->count++;
+
+    // Signal pthread_wait that buffer has more names to pull
+    pthread_cond_signal (&sv->not_empty);
+
+    // After copying to the buffer, unlock
+    pthread_mutex_unlock (&sv->buffer);
+}
+
 // Function called by first pthread_create; takes strings from input files and loads them into the buffer
 void *requester (void *shared_v)
 {
@@ -88,30 +154,7 @@ void *requester (void *shared_v)
         // While there are more lines to read into the hostname string:
         while (fscanf (sv->inputfp, INPUTFS, hostname) > 0)
         {
-            // Try to get lock for the buffer
-            pthread_mutex_lock (&sv->buffer);
-
-            // Check to make sure buffer is not full; if it is, wait until it isn't
-            while (sv->count >= MAX_INPUT_FILES)
-            {
-                // Wait until signal is received buffer has space for more names
-                // This conditional wait was taken from Assignment 6 code
-                pthread_cond_wait (&sv->not_full, &sv->buffer);
-            }
-
-            // Copy strings into buffer, use head pointer as it's the first free spot
-            strcpy (sv->shared_buffer [sv->head], hostname);
-            // Set head pointer to the next available spot; if it's outside the buffer wraparound to the beginning
-            sv->head = (++(sv->head) % MAX_INPUT_FILES);
-
-            // Iterate count by 1 to reflect buffer now has one more address
-            sv->count++;
-
-            // Signal pthread_wait that buffer has more names to pull
-            pthread_cond_signal (&sv->not_empty);
-
-            // After copying to the buffer, unlock
-            pthread_mutex_unlock (&sv->buffer);
+            buffer_put (sv, hostname, NULL);
         }
        
         // Close Input File
@@ -131,6 +174,878 @@ void *requester (void *shared_v)
     pthread_exit (NULL);
 }
 
+// Function to get milliseconds between two CLOCK_MONOTONIC times
+double elapsed_ms (struct timespec start, struct timespec end)
+{
+    return (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+// Function to add one latency sample (in milliseconds) to a histogram; caller holds stats.lock
+void latency_record (struct latency_histogram *hist, double ms)
+{
+    // Bucket b holds latencies up to 2^(b / LATENCY_BUCKETS_PER_DOUBLING) microseconds
+    double usec = ms * 1000.0;
+    int bucket = (usec <= 1.0) ? 0 : (int) ceil (log2 (usec) * LATENCY_BUCKETS_PER_DOUBLING);
+
+    if (bucket >= LATENCY_BUCKETS)
+    {
+        bucket = LATENCY_BUCKETS - 1;
+    }
+
+    hist->counts[bucket]++;
+    hist->total++;
+}
+
+// Function to get a percentile (0-100) out of a histogram in milliseconds; returns the upper edge of the bucket it lands in
+// Caller holds stats.lock
+double latency_percentile (struct latency_histogram *hist, double percentile)
+{
+    if (hist->total == 0)
+    {
+        return 0;
+    }
+
+    // Number of samples at or below the percentile we're looking for, rounded up so p100 is the max
+    long target = (long) ceil (hist->total * percentile / 100.0);
+    long seen = 0;
+
+    if (target < 1)
+    {
+        target = 1;
+    }
+
+    for (int b = 0; b < LATENCY_BUCKETS; b++)
+    {
+        seen += hist->counts[b];
+
+        if (seen >= target)
+        {
+            return pow (2.0, (double) b / LATENCY_BUCKETS_PER_DOUBLING) / 1000.0;
+        }
+    }
+
+    return pow (2.0, (double) (LATENCY_BUCKETS - 1) / LATENCY_BUCKETS_PER_DOUBLING) / 1000.0;
+}
+
+// Function to drop one reference to a lookup group, freeing it if that was the last one; caller holds group->lock
+void release_group (struct lookup_group *group)
+{
+    group->refs--;
+
+    if (group->refs == 0)
+    {
+        pthread_mutex_unlock (&group->lock);
+        pthread_mutex_destroy (&group->lock);
+        pthread_cond_destroy (&group->answered);
+        free (group);
+        return;
+    }
+
+    pthread_mutex_unlock (&group->lock);
+}
+
+// Function run by a detached attempt thread; does one blocking dnslookup and hands the answer to the group if nobody beat it
+// getaddrinfo can't be cancelled, so an attempt that blows past the deadline just finishes on its own later and throws the answer away
+void *lookup_attempt (void *attempt_v)
+{
+    struct lookup_attempt_arg *arg = (struct lookup_attempt_arg *) attempt_v;
+    struct lookup_group *group = arg->group;
+    int attempt = arg->attempt;
+    free (arg);
+
+    char ipstr[INET6_ADDRSTRLEN];
+    int status = dnslookup (group->hostname, ipstr, sizeof (ipstr));
+
+    if (status)
+    {
+        strncpy (ipstr, "", sizeof (ipstr));
+    }
+
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    // The first attempt's own latency is what an unhedged run without deadlines would have seen
+    pthread_mutex_lock (&stats.lock);
+    if (attempt == 1)
+    {
+        latency_record (&stats.first_attempt, elapsed_ms (group->start, now));
+        stats.outstanding--;
+    }
+    stats.attempts--;
+    pthread_mutex_unlock (&stats.lock);
+
+    pthread_mutex_lock (&group->lock);
+
+    if (!group->done)
+    {
+        group->done = 1;
+        group->winner = attempt;
+        group->status = status;
+        strcpy (group->ip, ipstr);
+        pthread_cond_signal (&group->answered);
+    }
+
+    release_group (group);
+
+    pthread_exit (NULL);
+}
+
+// Function to start a detached attempt thread for a group; caller holds group->lock
+// Returns 0 on success, or -1 if the thread couldn't be started or MAX_ATTEMPTS are already running
+int start_attempt (struct lookup_group *group, int attempt)
+{
+    // Claim a slot up front so resolvers racing for the last one can't both get it
+    pthread_mutex_lock (&stats.lock);
+    if (stats.attempts >= MAX_ATTEMPTS)
+    {
+        pthread_mutex_unlock (&stats.lock);
+        return -1;
+    }
+    stats.attempts++;
+    pthread_mutex_unlock (&stats.lock);
+
+    struct lookup_attempt_arg *arg = malloc (sizeof (struct lookup_attempt_arg));
+
+    if (!arg)
+    {
+        pthread_mutex_lock (&stats.lock);
+        stats.attempts--;
+        pthread_mutex_unlock (&stats.lock);
+        return -1;
+    }
+
+    arg->group = group;
+    arg->attempt = attempt;
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init (&attr);
+    pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+
+    int return_value = pthread_create (&thread, &attr, lookup_attempt, arg);
+    pthread_attr_destroy (&attr);
+
+    if (return_value)
+    {
+        fprintf (stderr, "Lookup attempt thread creation error; #%d\n", return_value);
+        free (arg);
+
+        pthread_mutex_lock (&stats.lock);
+        stats.attempts--;
+        pthread_mutex_unlock (&stats.lock);
+
+        return -1;
+    }
+
+    group->refs++;
+
+    return 0;
+}
+
+// Function to add milliseconds to a CLOCK_MONOTONIC time
+struct timespec add_ms (struct timespec t, double ms)
+{
+    long long nsec = t.tv_nsec + (long long) (ms * 1e6);
+
+    t.tv_sec += nsec / 1000000000LL;
+    t.tv_nsec = nsec % 1000000000LL;
+
+    return t;
+}
+
+// Function to look up a hostname with an optional deadline and an optional hedged second attempt
+// With neither turned on this is just dnslookup (plus latency bookkeeping), so the default run has no extra threads
+// Otherwise the lookup runs on a detached attempt thread and we wait for it on a condition variable:
+//   - once it has taken longer than the hedge percentile of observed first-attempt latency, a second attempt starts and whichever answers first wins
+//   - once the deadline passes we stop waiting and report a failed lookup; the attempt threads finish (and clean up) on their own
+// With MAX_ATTEMPTS threads already running (DNS is hanging and abandoned attempts have piled up) no hedge is started, and a new lookup runs
+// as a plain blocking dnslookup on the resolver itself, so resolvers slow down to the pace of the stuck lookups instead of leaving more threads behind
+int timed_lookup (const char *hostname, char *ipstr, int maxSize)
+{
+    struct timespec start, now;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+
+    if (stats.deadline_ms <= 0 && stats.hedge_percentile <= 0)
+    {
+        int status = dnslookup (hostname, ipstr, maxSize);
+
+        clock_gettime (CLOCK_MONOTONIC, &now);
+
+        pthread_mutex_lock (&stats.lock);
+        latency_record (&stats.effective, elapsed_ms (start, now));
+        latency_record (&stats.first_attempt, elapsed_ms (start, now));
+        pthread_mutex_unlock (&stats.lock);
+
+        return status;
+    }
+
+    // Work out when to hedge from what we've seen so far; no hedging until there's enough history for the percentile to be meaningful
+    double hedge_ms = -1;
+
+    pthread_mutex_lock (&stats.lock);
+    if (stats.hedge_percentile > 0 && stats.first_attempt.total >= MIN_HEDGE_SAMPLES)
+    {
+        hedge_ms = latency_percentile (&stats.first_attempt, stats.hedge_percentile);
+    }
+    stats.outstanding++;
+    pthread_mutex_unlock (&stats.lock);
+
+    struct lookup_group *group = malloc (sizeof (struct lookup_group));
+
+    if (!group)
+    {
+        fprintf (stderr, "Memory allocation failed\n");
+        exit (EXIT_FAILURE);
+    }
+
+    // Timed waits below use CLOCK_MONOTONIC deadlines, so the condition variable has to use that clock too
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init (&cond_attr);
+    pthread_condattr_setclock (&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init (&group->answered, &cond_attr);
+    pthread_condattr_destroy (&cond_attr);
+
+    pthread_mutex_init (&group->lock, NULL);
+    group->refs = 1;
+    group->done = 0;
+    group->status = UTIL_FAILURE;
+    group->start = start;
+    strncpy (group->hostname, hostname, sizeof (group->hostname));
+    group->hostname[sizeof (group->hostname) - 1] = '\0';
+
+    pthread_mutex_lock (&group->lock);
+
+    // If we can't start the attempt thread (or we're at MAX_ATTEMPTS), fall back to a plain blocking lookup
+    if (start_attempt (group, 1) != 0)
+    {
+        pthread_mutex_lock (&stats.lock);
+        stats.outstanding--;
+        pthread_mutex_unlock (&stats.lock);
+
+        release_group (group);
+
+        return dnslookup (hostname, ipstr, maxSize);
+    }
+
+    struct timespec deadline = add_ms (start, stats.deadline_ms);
+    int hedged = 0;
+
+    while (!group->done)
+    {
+        // Wait until the next thing that could happen: the hedge point (if we haven't hedged yet) or the deadline
+        int have_deadline = (stats.deadline_ms > 0);
+        int can_hedge = (!hedged && hedge_ms >= 0 && (!have_deadline || hedge_ms < stats.deadline_ms));
+        int return_value;
+
+        if (can_hedge)
+        {
+            struct timespec hedge_at = add_ms (start, hedge_ms);
+            return_value = pthread_cond_timedwait (&group->answered, &group->lock, &hedge_at);
+
+            if (return_value == ETIMEDOUT && !group->done)
+            {
+                hedged = 1;
+
+                if (start_attempt (group, 2) == 0)
+                {
+                    pthread_mutex_lock (&stats.lock);
+                    stats.hedges++;
+                    pthread_mutex_unlock (&stats.lock);
+                }
+            }
+        }
+
+        else if (have_deadline)
+        {
+            return_value = pthread_cond_timedwait (&group->answered, &group->lock, &deadline);
+
+            if (return_value == ETIMEDOUT && !group->done)
+            {
+                break;
+            }
+        }
+
+        else
+        {
+            pthread_cond_wait (&group->answered, &group->lock);
+        }
+    }
+
+    int status;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock (&stats.lock);
+    latency_record (&stats.effective, elapsed_ms (start, now));
+
+    if (group->done)
+    {
+        strncpy (ipstr, group->ip, maxSize);
+        ipstr[maxSize - 1] = '\0';
+        status = group->status;
+
+        if (group->winner == 2)
+        {
+            stats.hedge_wins++;
+        }
+    }
+
+    else
+    {
+        fprintf (stderr, "Lookup deadline exceeded: %s\n", hostname);
+        strncpy (ipstr, "", maxSize);
+        status = UTIL_FAILURE;
+        stats.timeouts++;
+    }
+    pthread_mutex_unlock (&stats.lock);
+
+    release_group (group);
+
+    return status;
+}
+
+// Function to look up a hostname with single-flight semantics
+// The first resolver to pick up a name does the real dnslookup; any resolver that gets the same name while that lookup is still
+// outstanding waits for it and copies the answer instead of sending its own query
+// Returns the dnslookup return value (UTIL_SUCCESS or UTIL_FAILURE) of whichever lookup produced the answer
+int coalesced_lookup (struct shared_variables *sv, const char *hostname, char *ipstr, int maxSize)
+{
+    struct inflight_lookup *slot = NULL;
+    struct inflight_lookup *free_slot = NULL;
+
+    pthread_mutex_lock (&sv->inflight_lock);
+
+    // Check if someone is already looking this name up, and remember a free slot in case nobody is
+    // A done slot only stays in use until its last waiter has copied the answer out; joining it would hand back an answer from a lookup
+    // that finished before this request was even pulled, so only lookups still running count
+    for (int i = 0; i < MAX_INFLIGHT; i++)
+    {
+        if (sv->inflight[i].in_use && !sv->inflight[i].done && strcmp (sv->inflight[i].name, hostname) == 0)
+        {
+            slot = &sv->inflight[i];
+            break;
+        }
+
+        if (!sv->inflight[i].in_use && !free_slot)
+        {
+            free_slot = &sv->inflight[i];
+        }
+    }
+
+    // Someone else has it; wait for their answer
+    if (slot)
+    {
+        sv->coalesced++;
+        slot->waiters++;
+
+        while (!slot->done)
+        {
+            pthread_cond_wait (&slot->resolved, &sv->inflight_lock);
+        }
+
+        strncpy (ipstr, slot->ip, maxSize);
+        ipstr[maxSize - 1] = '\0';
+
+        // Last one out frees the slot
+        slot->waiters--;
+        if (slot->waiters == 0)
+        {
+            slot->in_use = 0;
+        }
+
+        pthread_mutex_unlock (&sv->inflight_lock);
+
+        return ipstr[0] ? UTIL_SUCCESS : UTIL_FAILURE;
+    }
+
+    // We're first; claim a slot so duplicates can find us, then do the lookup without holding the lock
+    // free_slot can't be NULL while MAX_INFLIGHT >= number of resolvers, but fall back to an uncoalesced lookup just in case
+    sv->lookups++;
+
+    if (free_slot)
+    {
+        free_slot->in_use = 1;
+        free_slot->done = 0;
+        free_slot->waiters = 0;
+        strcpy (free_slot->name, hostname);
+    }
+
+    pthread_mutex_unlock (&sv->inflight_lock);
+
+    int status = timed_lookup (hostname, ipstr, maxSize);
+
+    if (status)
+    {
+        strncpy (ipstr, "", maxSize);
+    }
+
+    if (free_slot)
+    {
+        // Publish the answer and wake up anyone waiting on it
+        pthread_mutex_lock (&sv->inflight_lock);
+
+        strncpy (free_slot->ip, ipstr, sizeof (free_slot->ip));
+        free_slot->ip[sizeof (free_slot->ip) - 1] = '\0';
+        free_slot->done = 1;
+
+        if (free_slot->waiters == 0)
+        {
+            free_slot->in_use = 0;
+        }
+
+        else
+        {
+            pthread_cond_broadcast (&free_slot->resolved);
+        }
+
+        pthread_mutex_unlock (&sv->inflight_lock);
+    }
+
+    return status;
+}
+
+// Function to drop one reference to a daemon client; caller holds client->lock, which is released here
+// The last reference doesn't close anything itself, it tells the writer thread to finish up, since the writer may still have answers to send
+// The client can be freed as soon as the lock is released, so callers mustn't touch it afterwards
+void release_client (struct daemon_client *client)
+{
+    client->refs--;
+
+    if (client->refs == 0)
+    {
+        client->finished = 1;
+        pthread_cond_signal (&client->has_output);
+    }
+
+    pthread_mutex_unlock (&client->lock);
+}
+
+// Function to queue one line for a daemon client's writer thread; caller holds client->lock
+// Never blocks on the client itself: a socket client with a full backlog isn't reading its answers, so it's dropped (its socket is shut down,
+// which also ends its requester's fgets and any write the writer is stuck in) rather than letting it hold up resolvers that other clients share
+// The stdio client is the only client in that mode, so it gets backpressure instead and the resolver waits for room
+void client_send (struct daemon_client *client, const char *line)
+{
+    while (client->is_stdio && !client->dropped && client->backlog_count == CLIENT_BACKLOG)
+    {
+        pthread_cond_wait (&client->has_room, &client->lock);
+    }
+
+    if (!client->dropped && client->backlog_count == CLIENT_BACKLOG)
+    {
+        fprintf (stderr, "Dropping daemon client: %d answers unread\n", CLIENT_BACKLOG);
+        client->dropped = 1;
+        shutdown (fileno (client->out), SHUT_RDWR);
+    }
+
+    if (client->dropped)
+    {
+        return;
+    }
+
+    char* copy = malloc (strlen (line) + 1);
+
+    if (!copy)
+    {
+        fprintf (stderr, "Memory allocation failed\n");
+        exit (EXIT_FAILURE);
+    }
+
+    strcpy (copy, line);
+    client->backlog[(client->backlog_head + client->backlog_count) % CLIENT_BACKLOG] = copy;
+    client->backlog_count++;
+    pthread_cond_signal (&client->has_output);
+}
+
+// Function to queue one answer for a daemon client and drop the reference its hostname was holding
+void daemon_reply (struct daemon_client *client, const char *hostname, const char *ipstr)
+{
+    char line[MAX_NAME_LENGTH + INET6_ADDRSTRLEN + 2];
+    snprintf (line, sizeof (line), "%s,%s\n", hostname, ipstr);
+
+    pthread_mutex_lock (&client->lock);
+    client_send (client, line);
+    release_client (client);
+}
+
+// Function run by one writer thread per daemon client; writes queued lines out without holding client->lock, so a slow reader only blocks this thread
+// Exits once the client is finished and everything queued has been written (or thrown away), then closes socket clients
+void *daemon_writer (void *client_v)
+{
+    struct daemon_client *client = (struct daemon_client *) client_v;
+
+    pthread_mutex_lock (&client->lock);
+
+    while (1)
+    {
+        while (client->backlog_count == 0 && !client->finished)
+        {
+            pthread_cond_wait (&client->has_output, &client->lock);
+        }
+
+        if (client->backlog_count == 0)
+        {
+            break;
+        }
+
+        char* line = client->backlog[client->backlog_head];
+        client->backlog_head = (client->backlog_head + 1) % CLIENT_BACKLOG;
+        client->backlog_count--;
+        pthread_cond_signal (&client->has_room);
+
+        int dropped = client->dropped;
+        pthread_mutex_unlock (&client->lock);
+
+        // A client that already hung up just gets a failed write; stop writing to it after that
+        int failed = 0;
+
+        if (!dropped)
+        {
+            failed = (fputs (line, client->out) == EOF || fflush (client->out) != 0);
+        }
+
+        free (line);
+
+        pthread_mutex_lock (&client->lock);
+
+        if (failed)
+        {
+            client->dropped = 1;
+            pthread_cond_broadcast (&client->has_room);
+        }
+    }
+
+    pthread_mutex_unlock (&client->lock);
+
+    if (!client->is_stdio)
+    {
+        fclose (client->in);
+        fclose (client->out);
+        pthread_mutex_destroy (&client->lock);
+        pthread_cond_destroy (&client->has_output);
+        pthread_cond_destroy (&client->has_room);
+        free (client);
+    }
+
+    pthread_exit (NULL);
+}
+
+// Function to write live stats to a daemon client: answers so far, overall and recent throughput, queue depth and lookups in flight
+// "Recent" is since the previous STATS request from any client
+void daemon_stats (struct daemon_client *client)
+{
+    struct shared_variables *sv = client->sv;
+    static struct timespec last_time;
+    static long last_resolved = 0;
+    static pthread_mutex_t last_lock = PTHREAD_MUTEX_INITIALIZER;
+
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock (&sv->buffer);
+    int queued = sv->count;
+    pthread_mutex_unlock (&sv->buffer);
+
+    pthread_mutex_lock (&sv->results);
+    long resolved = sv->resolved;
+    pthread_mutex_unlock (&sv->results);
+
+    pthread_mutex_lock (&sv->inflight_lock);
+    int lookups = sv->lookups;
+    int coalesced = sv->coalesced;
+    int in_flight = 0;
+    for (int i = 0; i < MAX_INFLIGHT; i++)
+    {
+        in_flight += (sv->inflight[i].in_use && !sv->inflight[i].done);
+    }
+    pthread_mutex_unlock (&sv->inflight_lock);
+
+    pthread_mutex_lock (&last_lock);
+    if (last_time.tv_sec == 0)
+    {
+        last_time = sv->started;
+    }
+    double uptime = elapsed_ms (sv->started, now) / 1000.0;
+    double window = elapsed_ms (last_time, now) / 1000.0;
+    double recent_rate = (window > 0) ? (resolved - last_resolved) / window : 0;
+    last_time = now;
+    last_resolved = resolved;
+    pthread_mutex_unlock (&last_lock);
+
+    char line[256];
+    snprintf (line, sizeof (line), "stats resolved=%ld lookups=%d coalesced=%d queued=%d in_flight=%d uptime=%.1fs rate=%.1f/s recent_rate=%.1f/s\n",
+              resolved, lookups, coalesced, queued, in_flight, uptime, (uptime > 0) ? resolved / uptime : 0, recent_rate);
+
+    pthread_mutex_lock (&client->lock);
+    client_send (client, line);
+    pthread_mutex_unlock (&client->lock);
+}
+
+// Function run by one requester thread per daemon client; reads one hostname per line and feeds the shared pool
+// A line reading STATS gets the live stats back right away instead of being looked up
+// For the stdin client, EOF also means the whole daemon is done, so it trips requesterDone just like the batch requester
+void *daemon_requester (void *client_v)
+{
+    struct daemon_client *client = (struct daemon_client *) client_v;
+    struct shared_variables *sv = client->sv;
+
+    char line[MAX_NAME_LENGTH + 2];
+    char hostname[MAX_NAME_LENGTH];
+
+    while (fgets (line, sizeof (line), client->in))
+    {
+        // A line too long for the buffer can't hold a valid hostname; throw away the rest of it (otherwise it would come back as a bogus
+        // second name on the next fgets) and answer it with an error so the client still gets one line back per request
+        if (!strchr (line, '\n') && !feof (client->in))
+        {
+            while (fgets (line, sizeof (line), client->in) && !strchr (line, '\n'));
+
+            pthread_mutex_lock (&client->lock);
+            client_send (client, "error hostname too long\n");
+            pthread_mutex_unlock (&client->lock);
+            continue;
+        }
+
+        // Same parsing as the batch requester: first whitespace-separated word on the line, blank lines skipped
+        if (sscanf (line, INPUTFS, hostname) < 1)
+        {
+            continue;
+        }
+
+        if (strcmp (hostname, "STATS") == 0)
+        {
+            daemon_stats (client);
+            continue;
+        }
+
+        // The buffered name holds a reference so the client stays open until it's answered
+        pthread_mutex_lock (&client->lock);
+        client->refs++;
+        pthread_mutex_unlock (&client->lock);
+
+        buffer_put (sv, hostname, client);
+    }
+
+    if (client->is_stdio)
+    {
+        pthread_mutex_lock (&sv->buffer);
+        sv->requesterDone = 1;
+        pthread_cond_broadcast (&sv->not_empty);
+        pthread_mutex_unlock (&sv->buffer);
+    }
+
+    pthread_mutex_lock (&client->lock);
+    release_client (client);
+
+    pthread_exit (NULL);
+}
+
+// Function to set up a daemon client and start its writer thread; refs starts at 1 for its requester thread
+// The writer is detached for socket clients, since it frees the client itself; the stdio client's writer is joined in run_daemon
+struct daemon_client *new_client (struct shared_variables *sv, FILE* in, FILE* out, int is_stdio)
+{
+    struct daemon_client *client = malloc (sizeof (struct daemon_client));
+
+    if (!client)
+    {
+        fprintf (stderr, "Memory allocation failed\n");
+        exit (EXIT_FAILURE);
+    }
+
+    client->sv = sv;
+    client->in = in;
+    client->out = out;
+    client->is_stdio = is_stdio;
+    client->refs = 1;
+    client->finished = 0;
+    client->dropped = 0;
+    client->backlog_head = 0;
+    client->backlog_count = 0;
+    pthread_mutex_init (&client->lock, NULL);
+    pthread_cond_init (&client->has_output, NULL);
+    pthread_cond_init (&client->has_room, NULL);
+
+    int return_value = pthread_create (&client->writer, NULL, daemon_writer, (void *) client);
+
+    if (return_value)
+    {
+        fprintf(stderr, "Writer thread creation error; #%d\n", return_value);
+        exit(-1);
+    }
+
+    if (!is_stdio)
+    {
+        pthread_detach (client->writer);
+    }
+
+    return client;
+}
+
+// Path of the daemon's Unix socket, so the signal handler can clean it up
+const char *daemon_socket_path = NULL;
+
+// Function called on SIGINT/SIGTERM in socket daemon mode; removes the socket file and exits
+void daemon_shutdown (int sig)
+{
+    (void) sig;
+
+    if (daemon_socket_path)
+    {
+        unlink (daemon_socket_path);
+    }
+
+    _exit (EXIT_SUCCESS);
+}
+
+// Daemon mode: keep the resolver pool alive and resolve hostnames as they arrive, writing each answer back as soon as it's resolved
+// With no address we serve stdin/stdout and exit at EOF; with unix:<path> we serve any number of socket clients until killed
+// Each client gets its own requester thread, and all of them share the one bounded buffer and resolver pool
+int run_daemon (struct shared_variables *sv, const char *address)
+{
+    pthread_t c_threads[MAX_RESOLVER_THREADS];
+    pthread_t p_thread;
+    int return_value;
+
+    clock_gettime (CLOCK_MONOTONIC, &sv->started);
+
+    // A client hanging up mid-answer should show up as a failed write, not kill the daemon
+    signal (SIGPIPE, SIG_IGN);
+
+    // Set up the listening socket first so a bad address fails before any threads exist
+    int listen_fd = -1;
+
+    if (address)
+    {
+        if (strncmp (address, "unix:", 5) != 0)
+        {
+            fprintf (stderr, "Unknown address (expected unix:<socketPath>): %s\n", address);
+            return EXIT_FAILURE;
+        }
+
+        struct sockaddr_un addr;
+        memset (&addr, 0, sizeof (addr));
+        addr.sun_family = AF_UNIX;
+        strncpy (addr.sun_path, address + 5, sizeof (addr.sun_path) - 1);
+
+        listen_fd = socket (AF_UNIX, SOCK_STREAM, 0);
+
+        // Clear out a socket file left behind by an earlier run
+        unlink (addr.sun_path);
+
+        if (listen_fd < 0 || bind (listen_fd, (struct sockaddr*) &addr, sizeof (addr)) != 0 || listen (listen_fd, MAX_RESOLVER_THREADS) != 0)
+        {
+            perror (address);
+            return EXIT_FAILURE;
+        }
+
+        daemon_socket_path = address + 5;
+        signal (SIGINT, daemon_shutdown);
+        signal (SIGTERM, daemon_shutdown);
+    }
+
+    // Start the resolver pool once; it stays up for the life of the daemon
+    for (int m = 0; m < MAX_RESOLVER_THREADS; m++)
+    {
+        return_value = pthread_create (&c_threads[m], NULL, resolver, (void *) sv);
+
+        if (return_value)
+        {
+            fprintf(stderr, "Resolver thread creation error; #%d\n", return_value);
+            exit(-1);
+        }
+    }
+
+    if (!address)
+    {
+        struct daemon_client *client = new_client (sv, stdin, stdout, 1);
+
+        return_value = pthread_create (&p_thread, NULL, daemon_requester, (void *) client);
+
+        if (return_value)
+        {
+            fprintf(stderr, "Requester thread creation error; #%d\n", return_value);
+            exit(-1);
+        }
+
+        // Requester trips requesterDone at EOF, after which the resolvers drain the buffer and exit
+        pthread_join (p_thread, NULL);
+
+        for (int n = 0; n < MAX_RESOLVER_THREADS; n++)
+        {
+            pthread_join(c_threads[n], NULL);
+        }
+
+        // Every answer has been queued by now, so the writer finishes as soon as it's written them
+        pthread_join (client->writer, NULL);
+        pthread_mutex_destroy (&client->lock);
+        pthread_cond_destroy (&client->has_output);
+        pthread_cond_destroy (&client->has_room);
+        free (client);
+
+        return EXIT_SUCCESS;
+    }
+
+    // Socket mode: one detached requester thread per connection, forever
+    while (1)
+    {
+        int fd = accept (listen_fd, NULL, NULL);
+
+        if (fd < 0)
+        {
+            continue;
+        }
+
+        // Separate FILE*s for reading and writing the same socket, since one stdio stream can't safely do both
+        int out_fd = dup (fd);
+        FILE* in = fdopen (fd, "r");
+        FILE* out = (out_fd >= 0) ? fdopen (out_fd, "w") : NULL;
+
+        if (!in || !out)
+        {
+            perror ("Error Opening Client Connection");
+
+            if (in)
+            {
+                fclose (in);
+            }
+
+            else
+            {
+                close (fd);
+            }
+
+            if (out)
+            {
+                fclose (out);
+            }
+
+            else if (out_fd >= 0)
+            {
+                close (out_fd);
+            }
+
+            continue;
+        }
+
+        struct daemon_client *client = new_client (sv, in, out, 0);
+
+        pthread_attr_t attr;
+        pthread_attr_init (&attr);
+        pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+        return_value = pthread_create (&p_thread, &attr, daemon_requester, (void *) client);
+        pthread_attr_destroy (&attr);
+
+        if (return_value)
+        {
+            fprintf(stderr, "Requester thread creation error; #%d\n", return_value);
+
+            // Dropping the requester's reference lets the writer close and free the client
+            pthread_mutex_lock (&client->lock);
+            release_client (client);
+        }
+    }
+}
+
 // Function called by second pthread_create; takes strings from buffer and checks if they're legit. If they are, puts them in results
 void *resolver (void * shared_v)
 {
@@ -140,12 +1055,21 @@ void *resolver (void * shared_v)
     // String to hold IP string
     char firstipstr[INET6_ADDRSTRLEN];
 
+    // Where the answer goes; NULL for the output file
+    struct daemon_client *client;
+
     // Recast variable back to struct from void *
     struct shared_variables *sv = (struct shared_variables *) shared_v;
 
+    // This resolver's share of the overhead breakdown; kept locally and added to sv once at exit
+    double buffer_time = 0, lookup_time = 0, write_time = 0;
+    double phase_start;
+
     // Infinitely loop until requester signals it's done
     while (1)
     {
+        phase_start = breakdown_now ();
+
         // Need to lock the buffer to read from it and remove a string
         pthread_mutex_lock (&sv->buffer);
 
@@ -161,11 +1085,31 @@ void *resolver (void * shared_v)
         if (sv->count < 1 && sv->requesterDone) 
         {
             pthread_mutex_unlock (&sv->buffer);
+
+            buffer_time += breakdown_now () - phase_start;
+
+            pthread_mutex_lock (&sv->results);
+            sv->buffer_time += buffer_time;
+            sv->write_time += write_time;
+            sv->lookup_sum += lookup_time;
+            if (sv->resolvers_done == 0 || lookup_time < sv->lookup_min)
+            {
+                sv->lookup_min = lookup_time;
+            }
+            if (sv->resolvers_done == 0 || lookup_time > sv->lookup_max)
+            {
+                sv->lookup_max = lookup_time;
+            }
+            sv->resolvers_done++;
+            sv->last_exit = breakdown_now ();
+            pthread_mutex_unlock (&sv->results);
+
             pthread_exit (NULL);
         }
 
         // Take string from buffer, targeting oldest existing name at the tail, and copy into local variable
         strcpy (lookupName, sv->shared_buffer[sv->tail]);
+        client = sv->shared_client[sv->tail];
         // Mark the spot we removed the string from the buffer as ready to be filled
         sv->shared_buffer[sv->tail][0] = '\0';  
         // Set tail pointer to the next available spot; if it's outside the buffer wraparound to the beginning
@@ -179,27 +1123,53 @@ void *resolver (void * shared_v)
 
         // Done checking the buffer, unlock it
         pthread_mutex_unlock (&sv->buffer);
+
+        buffer_time += breakdown_now () - phase_start;
+        phase_start = breakdown_now ();
         
         // Lookup code borrowed from lookup.c
-        // Lookup the hostname and get IP string
-        if(dnslookup (lookupName, firstipstr, sizeof(firstipstr)))
+        // Lookup the hostname and get IP string; duplicate names already being looked up by another resolver share that lookup
+        if(coalesced_lookup (sv, lookupName, firstipstr, sizeof(firstipstr)))
         {
             // Error Check: Lookup error
             fprintf (stderr, "dnslookup error: %s\n", lookupName);
-            fflush (sv->outputfp);
+
+            // Daemon mode has no output file
+            if (sv->outputfp)
+            {
+                fflush (sv->outputfp);
+            }
             strncpy (firstipstr, "", sizeof(firstipstr));
         }
         
 
+        lookup_time += breakdown_now () - phase_start;
+        phase_start = breakdown_now ();
+
+        // Daemon mode: answer goes straight back to whoever asked, as soon as it's resolved
+        if (client)
+        {
+            daemon_reply (client, lookupName, firstipstr);
+
+            pthread_mutex_lock (&sv->results);
+            sv->resolved++;
+            pthread_mutex_unlock (&sv->results);
+
+            continue;
+        }
+
         // Now we need to write results to the results file, so we attempt to acquire the lock
         pthread_mutex_lock (&sv->results);
 
         // Write to Output File, flush to make sure it happens immediately
         fprintf (sv->outputfp, "%s,%s\n", lookupName, firstipstr);
         fflush (sv->outputfp);
+        sv->resolved++;
 
         // After writing, unlock
         pthread_mutex_unlock (&sv->results);
+
+        write_time += breakdown_now () - phase_start;
     }
 
     // If thread somehow reaches here (it shouldn't ever), exit
@@ -211,10 +1181,36 @@ int main(int argc, char* argv[])
     // Initialize struct
     struct shared_variables sv;
 
+    // Memory instrumentation (only with -DMEMSTATS); one line per phase in C_DNSResolverMemory.txt
+    memstats_begin ();
+
+    // Optional flags before the input files; shift them off argv so the requester still sees <inputs...> <output>
+    // -d <ms>: per-lookup deadline, -p <percentile>: hedge once a lookup has run longer than this percentile of observed latency
+    memset (&stats, 0, sizeof (stats));
+    pthread_mutex_init (&stats.lock, NULL);
+
+    while (argc > 2 && (strcmp (argv[1], "-d") == 0 || strcmp (argv[1], "-p") == 0))
+    {
+        if (argv[1][1] == 'd')
+        {
+            stats.deadline_ms = atoi (argv[2]);
+        }
+
+        else
+        {
+            stats.hedge_percentile = atof (argv[2]);
+        }
+
+        argv[2] = argv[0];
+        argc -= 2;
+        argv += 2;
+    }
+
     // Initialize shared_buffer first chars to zero so code works
     for (int q = 0; q < 10; q++)
     {
         sv.shared_buffer[q][0] = 0;
+        sv.shared_client[q] = NULL;
     }
 
     // Inititalize sv variables
@@ -224,6 +1220,23 @@ int main(int argc, char* argv[])
     sv.requesterDone = 0;
     sv.head = 0;
     sv.tail = 0;
+    sv.lookups = 0;
+    sv.coalesced = 0;
+    sv.resolved = 0;
+    sv.resolvers_done = 0;
+    sv.buffer_time = 0;
+    sv.write_time = 0;
+    sv.lookup_min = 0;
+    sv.lookup_sum = 0;
+    sv.lookup_max = 0;
+    sv.last_exit = 0;
+
+    // In-flight table starts empty
+    for (int q = 0; q < MAX_INFLIGHT; q++)
+    {
+        sv.inflight[q].in_use = 0;
+        pthread_cond_init (&sv.inflight[q].resolved, NULL);
+    }
 
     // Initialize thread pointer variables
     // Only need one producer thread pointer, as we only need one requester
@@ -238,6 +1251,18 @@ int main(int argc, char* argv[])
     pthread_mutex_init(&sv.results, NULL);
     pthread_cond_init(&sv.not_full, NULL);
     pthread_cond_init(&sv.not_empty, NULL);
+    pthread_mutex_init(&sv.inflight_lock, NULL);
+
+    // Daemon mode takes hostnames from stdin or a socket instead of input files, and has no output file
+    if (argc > 1 && strcmp (argv[1], "--daemon") == 0)
+    {
+        sv.outputfp = NULL;
+
+        int status = run_daemon (&sv, (argc > 2) ? argv[2] : NULL);
+        memstats_phase ("C_DNSResolverMemory.txt", "daemon");
+
+        return status;
+    }
 
      
     // Error Check: Check Arguments 
@@ -246,7 +1271,7 @@ int main(int argc, char* argv[])
     if(argc < MINARGS)
     {
         fprintf(stderr, "Not enough arguments: %d\n", (argc - 1));
-        fprintf(stderr, "Usage:\n %s %s\n", argv[0], USAGE);
+        fprintf(stderr, "Usage:\n %s " USAGE "\n", argv[0], argv[0]);
         return EXIT_FAILURE;
     }
  
@@ -275,8 +1300,11 @@ int main(int argc, char* argv[])
 
     // Calculate time taken; initialize clock and start timer
     // Code borrowed from CSCI440 github repo timing.c example
+    memstats_phase ("C_DNSResolverMemory.txt", "setup");
+
     struct timespec time_start, time_end;
     clock_gettime (CLOCK_MONOTONIC, &time_start);
+    double spawn_begin = breakdown_now ();
 
     // Create Threads       
     // Check for error when making threads; pthread_create passes 0 back if threads were created successfully
@@ -308,6 +1336,8 @@ int main(int argc, char* argv[])
             exit(-1);
         }
     }
+
+    double spawn_end = breakdown_now ();
     
     // Join requester thread
     pthread_join (p_thread, NULL);
@@ -320,28 +1350,75 @@ int main(int argc, char* argv[])
 
     // Finish timer as work is done
     clock_gettime (CLOCK_MONOTONIC, &time_end);
+    memstats_phase ("C_DNSResolverMemory.txt", "resolve");
 
     // Calculate time taken
     // NOTE: kept getting negative time results, so we have to modify this part to make sure that doesn't happen
-    double time_taken; // = ((end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec)) / 1e9;
+    double time_taken;
 
     // Error occurs if the end_time.tv_nsec is less than start_time.tv_nsec due to wraparound errors; if statement checks if that's the case
+    // Only the nanosecond part gets divided by 1e9
     if (time_end.tv_nsec < time_start.tv_nsec) 
     {
-        time_taken = ((time_end.tv_sec - time_start.tv_sec - 1) + (time_end.tv_nsec + 1e9 - time_start.tv_nsec)) / 1e9;
+        time_taken = (time_end.tv_sec - time_start.tv_sec - 1) + (time_end.tv_nsec + 1e9 - time_start.tv_nsec) / 1e9;
     } 
         
     else 
     {
-        time_taken = ((time_end.tv_sec - time_start.tv_sec) + (time_end.tv_nsec - time_start.tv_nsec)) / 1e9;
+        time_taken = (time_end.tv_sec - time_start.tv_sec) + (time_end.tv_nsec - time_start.tv_nsec) / 1e9;
     }
 
     // Print time taken to output file
     fprintf (time_output, "%lf\n", time_taken );
+
+    // Report how many upstream queries duplicate coalescing saved
+    printf ("lookups: %d, coalesced: %d\n", sv.lookups, sv.coalesced);
+
+    // Report tail latency with hedging/deadlines (what resolvers actually waited) and for first attempts alone (what they'd have waited without)
+    // First attempts that were abandoned and are still running aren't in the second set
+    pthread_mutex_lock (&stats.lock);
+
+    double p50 = latency_percentile (&stats.effective, 50);
+    double p99 = latency_percentile (&stats.effective, 99);
+    double p999 = latency_percentile (&stats.effective, 99.9);
+    double first_p50 = latency_percentile (&stats.first_attempt, 50);
+    double first_p99 = latency_percentile (&stats.first_attempt, 99);
+    double first_p999 = latency_percentile (&stats.first_attempt, 99.9);
+
+    printf ("lookup latency ms (deadline %d, hedge p%g): p50 %.3f, p99 %.3f, p999 %.3f\n",
+            stats.deadline_ms, stats.hedge_percentile, p50, p99, p999);
+    printf ("first attempt only ms: p50 %.3f, p99 %.3f, p999 %.3f (%d still running)\n",
+            first_p50, first_p99, first_p999, stats.outstanding);
+    printf ("hedges: %d, hedge wins: %d, timeouts: %d\n", stats.hedges, stats.hedge_wins, stats.timeouts);
+
+    // Output format is deadline,hedge percentile,p50,p99,p999,first attempt p50,p99,p999,hedges,hedge wins,timeouts
+    FILE* latency_output = fopen ("C_DNSLatency.txt", "a");
+
+    if (latency_output)
+    {
+        fprintf (latency_output, "%d,%g,%f,%f,%f,%f,%f,%f,%d,%d,%d\n", stats.deadline_ms, stats.hedge_percentile,
+                 p50, p99, p999, first_p50, first_p99, first_p999, stats.hedges, stats.hedge_wins, stats.timeouts);
+        fclose (latency_output);
+    }
+
+    pthread_mutex_unlock (&stats.lock);
  
     // Close Output Files
     fclose (sv.outputfp);
     fclose (time_output);
+
+    // Overhead breakdown; resolvers are the workers here
+    // distribute is the average time a resolver spent getting names out of the bounded buffer (including waiting on the requester),
+    // compute is each resolver's total lookup time, gather is the average time spent writing results,
+    // and teardown is from the last resolver finishing to the joins and file cleanup being done
+    double teardown_end = breakdown_now ();
+    int resolvers = (sv.resolvers_done > 0) ? sv.resolvers_done : 1;
+
+    breakdown_write ("C_DNSResolverBreakdown.txt", sv.resolvers_done, spawn_end - spawn_begin, sv.buffer_time / resolvers,
+                     sv.lookup_min, sv.lookup_sum / resolvers, sv.lookup_max, sv.write_time / resolvers,
+                     teardown_end - sv.last_exit, teardown_end - spawn_begin);
+
+    memstats_phase ("C_DNSResolverMemory.txt", "teardown");
  
     return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -23,6 +23,9 @@ import socket
 import sys
 import time
 
+import breakdown
+import memstats
+
 # Constants, set to same as C file
 MAX_INPUT_FILES = 10
 MAX_RESOLVER_PROCESSES = 10
@@ -37,6 +40,7 @@ MIN_RESOLVER_PROCESSES = 2
     # not_full and not_empty are the two conditions for the buffer lock
     # locks required due to critical sections, same as in C program, conditional locks help with requester/resolver
     # Requester_done_flag is the boolean value that is tripped when the requester thread has done all it's work
+    # timings is where each resolver leaves its (buffer, lookup, write, exit time) totals for the overhead breakdown when it exits
     # NOTE: Python recommends not using lock.acquire/lock.release manually, as using 'with' with locks automatically releases them when the action has been completed
     # Had to switch conditional lock/buffer to mp instead of manager to avoid errors
 class shared_variables:
@@ -47,6 +51,7 @@ class shared_variables:
         self.not_empty = manager.Condition (self.buffer_lock)
         self.not_full = manager.Condition (self.buffer_lock)
         self.done_flag = manager.Value ('b', False)
+        self.timings = manager.list ()
 
 # NOTE: We use python's DNS lookup feature here because it's super easy to implement, and is certainly easier than figuring out how to
 # get python to run util.c or translating util.c to python
@@ -101,8 +106,13 @@ def requester (sv, input_files):
 
 
 def resolver (sv, output_file): 
+    # This resolver's share of the overhead breakdown; kept locally and sent to the manager once at exit, same as the C version
+    # Buffer time here includes the round trips to the manager process, which is most of Python's distribute overhead
+    buffer_time = lookup_time = write_time = 0
+
     # Endlessly loop until flag is tripped
     while True:
+        phase_start = time.monotonic_ns ()
 
         # Check conditional variable to make sure we have strings to remove from the buffer
         with sv.not_empty:
@@ -112,6 +122,8 @@ def resolver (sv, output_file):
 
                 # Check if done_flag is true, if so, we leave the function
                 if sv.done_flag.value:
+                    buffer_time += time.monotonic_ns () - phase_start
+                    sv.timings.append ((buffer_time, lookup_time, write_time, time.monotonic_ns ()))
                     return
 
                 # Otherwise, wait until conditional variable signals there are strings in the buffer
@@ -123,17 +135,28 @@ def resolver (sv, output_file):
             # After a string has been removed from the buffer, signal there is room in the buffer
             sv.not_full.notify ()
 
+        buffer_time += time.monotonic_ns () - phase_start
+        phase_start = time.monotonic_ns ()
+
         # Call the dnslookup function on the string to determine IP address
         # Returns IP address is successful, empty string on failure
         ip = dnslookup (hostname)
 
+        lookup_time += time.monotonic_ns () - phase_start
+        phase_start = time.monotonic_ns ()
+
         # Obtain output file lock, and write results to the output file
         with sv.file_lock:
             with open(output_file, 'a') as f:
                 f.write(f"{hostname},{ip}\n")
 
+        write_time += time.monotonic_ns () - phase_start
+
 
 def main ():
+    # Memory instrumentation (only with MEMSTATS=1); one line per phase in PyDNSResolverMemory.txt
+    memstats.begin ()
+
     # Error Check: Check Arguments
     # Make sure we have program call, input file(s), and output file
     if len (sys.argv) < 3:
@@ -152,6 +175,9 @@ def main ():
         pass
 
     # Initialize manager so processes can share object
+    # Starting the manager is a separate server process, so it counts towards spawn in the breakdown
+    memstats.phase ("PyDNSResolverMemory.txt", "setup")
+    spawn_begin = time.monotonic_ns ()
     manager = mp.Manager ()
     sv = shared_variables (manager)
 
@@ -178,6 +204,8 @@ def main ():
         resolver_processes.start ()
         res_procs_array.append (resolver_processes)
 
+    spawn_end = time.monotonic_ns ()
+
     # Wait for processes to finish, requester first, then join the resolver processes after
     requester_process.join ()
     for resolver_processes in res_procs_array:
@@ -185,12 +213,33 @@ def main ():
 
     # End timer, calculate time taken
     end_time = time.time_ns ()
+    memstats.phase ("PyDNSResolverMemory.txt", "resolve")
     time_taken = (end_time - start_time) / (10 ** 9)
 
     # Define and open output file to store results in
-    with open ("PyDNSResolver.txt", "a") as output:
-        # output.write (f"Time taken: {time_taken:.6f} seconds - Estimated Pi: {pi_estimate:.10f}\n")
-        output.write (f"{time_taken:.6f}\n")
+    # Timing files are skipped when memory instrumentation is on, since tracemalloc and the phase bookkeeping inflate the times
+    if not memstats.ENABLED:
+        with open ("PyDNSResolver.txt", "a") as output:
+            # output.write (f"Time taken: {time_taken:.6f} seconds - Estimated Pi: {pi_estimate:.10f}\n")
+            output.write (f"{time_taken:.6f}\n")
+
+    # Overhead breakdown, same columns as C_DNSResolverBreakdown.txt; resolvers are the workers, and teardown is from the last resolver exiting to the manager shutting down
+    timings = list (sv.timings)
+    manager.shutdown ()
+    teardown_end = time.monotonic_ns ()
+
+    # The manager's server process has exited now, so teardown includes its faults/RSS
+    memstats.phase ("PyDNSResolverMemory.txt", "teardown")
+
+    resolvers = max (len (timings), 1)
+    lookups = [lookup / breakdown.NS for _, lookup, _, _ in timings] or [0]
+    last_exit = max ((exit_time for *_, exit_time in timings), default = teardown_end)
+
+    if not memstats.ENABLED:
+        breakdown.write_line ("PyDNSResolverBreakdown.txt", len (timings), (spawn_end - spawn_begin) / breakdown.NS,
+                              sum (t[0] for t in timings) / resolvers / breakdown.NS, min (lookups), sum (lookups) / resolvers, max (lookups),
+                              sum (t[2] for t in timings) / resolvers / breakdown.NS, (teardown_end - last_exit) / breakdown.NS,
+                              (teardown_end - spawn_begin) / breakdown.NS)
 
 if __name__ == '__main__':
     # I ran into errors that suggested this code be used for Linux/WSL compatibility
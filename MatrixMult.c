@@ -13,49 +13,1135 @@ Resources used:
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
 
+#include "breakdown.h"
+#include "memstats.h"
+
+#define USAGE "[-v <rounds>] [-s <seed>] [dense | sparse <size> <density %> | sweep <size> | gen <file> <size> | ooc <fileA> <fileB> <fileC> <memory MB> | batch <n> <count> [reps]]"
+
+// On-disk matrix format used by the gen/ooc modes: a fixed 32 byte header followed by rows * cols ints in row-major order
+// The header is 32 bytes so the int data after it stays aligned inside the mmap'd file
+#define MATRIX_FILE_MAGIC "TMMX"
+#define MATRIX_HEADER_SIZE 32
+
+typedef struct
+{
+    char magic[4];
+    uint32_t elem_size;
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t reserved;
+
+} matrixFileHeader;
+
 // Global variables:
 // Initialize size variable, as well as pointers to matrices and the resulting matrix; have to do pointer-to-pointer to avoid errors
 // While I initially wanted to avoid completely avoid global variables and use a struct, the fact that each thread must also pass in the rows it will do work on caused problems, both for setting up the struct, and some strange mutex errors.
 // I had to choose between creating a struct for each separate thread, or using global variables and smaller structs. This should save on memory allocation, and if performed correctly,
 // should avoid the need to use mutex in a similar manner as bestcount.c as each thread is modifying a separate row in the matrix and shouldn't have access to the same memory spaces
 
-// NOTE: Size is the variable we change to vary the difficulty of the program. 64, 256, and 512 are the testing sizes
-int size = 64;
-int **matrixA;
-int **matrixB;
-int **result;
+// NOTE: Size is the variable we change to vary the difficulty of the program. 64, 256, and 512 are the testing sizes
+int size = 64;
+int **matrixA;
+int **matrixB;
+int **result;
+
+// Create structure for threads to know what rows they do work on
+typedef struct 
+{
+    int start_row;
+    int end_row;
+    int worker;
+
+} rowInfo;
+
+// Per-worker compute start/end times for the overhead breakdown of the dense benchmark; NULL when not being recorded
+// Each thread only writes its own entries, so no locks needed
+double* worker_start;
+double* worker_end;
+
+// Compressed Sparse Row (CSR) version of a matrix; only the non-zero values are stored
+// row_ptr[i] to row_ptr[i + 1] gives the range of col_idx/values entries that belong to row i, so row_ptr has size + 1 entries
+// Most of our production matrices are mostly zeros, so this lets the multiply skip all of the zero * something work the dense kernel does
+typedef struct
+{
+    int nnz;
+    int* row_ptr;
+    int* col_idx;
+    int* values;
+
+} csrMatrix;
+
+// Sparse version of matrixA, only filled in by the sparse/sweep modes
+csrMatrix* sparseA;
+
+// State for the out-of-core (ooc) mode; A, B and C point at the int data inside the mmap'd matrix files
+// Threads work on rows of the current A panel against the current B panel [k_start, k_end), so these get updated once per panel pair
+typedef struct
+{
+    int* A;
+    int* B;
+    int* C;
+    int k_start;
+    int k_end;
+
+} oocPanels;
+
+oocPanels ooc;
+
+// Number of Freivalds verification rounds to run after each timed multiply; 0 (the default) turns verification off
+// Each round that passes halves the chance a wrong result slips through, so 20 rounds is about a one in a million miss rate
+int verify_rounds = 0;
+
+// Set once any verification fails, so main can return an error after the results are still written out
+int verify_failed = 0;
+
+// Seed for the random input matrices; -s <seed> sets it so a run can be repeated exactly, otherwise it's the current time like before
+// The dense benchmark fills its matrices in parallel from this seed, and the other modes pass it to srand
+uint64_t fill_seed;
+
+// State for the verification matrix-vector products; out = mat * in, split across threads by rows like the multiply kernels
+// Uses 64-bit sums so the check itself can't overflow even when the int result matrix would
+typedef struct
+{
+    int** mat;
+    int64_t* in;
+    int64_t* out;
+
+} matVec;
+
+matVec mv;
+
+// Thread function to compute multiple rows of the result matrix
+void* multiply_rows (void* rowID) 
+{
+    // Convert struct back from a void* to a struct
+    rowInfo *rows = (rowInfo*) rowID;
+
+    if (worker_start)
+        worker_start[rows->worker] = breakdown_now ();
+
+    // For loop to track row #
+    for (int i = rows->start_row; i < rows->end_row; i++) 
+    {
+        // For loop to keep track of result/matrixB column #
+        for (int j = 0; j < size; j++)
+        {
+            // Inner for loop to do the multiplication
+            for (int k = 0; k < size; k++) 
+            {
+                // NOTE: Should not need mutex locks here as each thread has it's own row to do math with, and they should not be accessing the same memory space except to read
+                result[i][j] += matrixA[i][k] * matrixB[k][j];
+            }
+        }
+    }
+
+    if (worker_end)
+        worker_end[rows->worker] = breakdown_now ();
+
+    // Free malloc'd row memory
+    free (rows);
+
+    // Return when finished
+    pthread_exit (NULL);
+}
+
+// Function to get the next number from a splitmix64 stream; small, fast, and every state gives a good stream, so it's safe to seed one per row
+uint64_t splitmix64 (uint64_t* state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+    return z ^ (z >> 31);
+}
+
+// Thread function to fill its rows of matrixA and matrixB with random values between 0 and 99 and zero the same rows of result
+// rand () is one shared stream behind a lock, so instead every row of every matrix gets its own stream seeded from fill_seed and the row number;
+// that way the matrices come out the same for a given seed no matter how many threads split up the rows
+// Each thread also ends up being the first to touch its own rows, which the multiply threads with the same rows will be reading next
+void* fill_rows (void* rowID)
+{
+    // Convert struct back from a void* to a struct
+    rowInfo *rows = (rowInfo*) rowID;
+
+    for (int i = rows->start_row; i < rows->end_row; i++)
+    {
+        // Streams 2i and 2i + 1 are row i of A and B; multiplying by an odd constant spreads neighbouring rows far apart in splitmix64's sequence
+        uint64_t stateA = fill_seed ^ ((uint64_t) i * 2) * 0xD1B54A32D192ED03ULL;
+        uint64_t stateB = fill_seed ^ ((uint64_t) i * 2 + 1) * 0xD1B54A32D192ED03ULL;
+
+        for (int j = 0; j < size; j++)
+        {
+            matrixA[i][j] = splitmix64 (&stateA) % 100;
+            matrixB[i][j] = splitmix64 (&stateB) % 100;
+        }
+
+        memset (result[i], 0, size * sizeof (int));
+    }
+
+    // Free malloc'd row memory
+    free (rows);
+
+    // Return when finished
+    pthread_exit (NULL);
+}
+
+// Thread function to compute multiple rows of the result matrix with the i-k-j loop order the CSR kernel uses
+// Used as the dense side of the sparse/sweep comparisons; multiply_rows walks B down a column, which is slow enough on its own
+// to make CSR look faster even with no zeros at all, so this keeps the loop order the same and leaves sparsity as the only difference
+void* multiply_rows_ikj (void* rowID)
+{
+    // Convert struct back from a void* to a struct
+    rowInfo *rows = (rowInfo*) rowID;
+
+    for (int i = rows->start_row; i < rows->end_row; i++)
+    {
+        // Every A[i][k], zero or not, gets multiplied by all of row k in B and added to row i of the result
+        for (int k = 0; k < size; k++)
+        {
+            int a_value = matrixA[i][k];
+
+            for (int j = 0; j < size; j++)
+            {
+                result[i][j] += a_value * matrixB[k][j];
+            }
+        }
+    }
+
+    // Free malloc'd row memory
+    free (rows);
+
+    // Return when finished
+    pthread_exit (NULL);
+}
+
+// Thread function to compute multiple rows of the result matrix when matrixA is stored in CSR format (SpMM; sparse A times dense B)
+// Same row ownership rules as multiply_rows, so we still don't need any mutex locks
+void* multiply_sparse_rows (void* rowID)
+{
+    // Convert struct back from a void* to a struct
+    rowInfo *rows = (rowInfo*) rowID;
+
+    for (int i = rows->start_row; i < rows->end_row; i++)
+    {
+        // Only walk the non-zero entries of row i in A
+        // Each non-zero A[i][k] gets multiplied by all of row k in B and added to row i of the result,
+        // which also means we read B row by row instead of jumping down a column like multiply_rows does
+        for (int p = sparseA->row_ptr[i]; p < sparseA->row_ptr[i + 1]; p++)
+        {
+            int k = sparseA->col_idx[p];
+            int a_value = sparseA->values[p];
+
+            for (int j = 0; j < size; j++)
+            {
+                result[i][j] += a_value * matrixB[k][j];
+            }
+        }
+    }
+
+    // Free malloc'd row memory
+    free (rows);
+
+    // Return when finished
+    pthread_exit (NULL);
+}
+
+// Thread function for the ooc mode; multiplies the thread's rows of the current A panel by the current B panel and adds into C
+// Matrices are flat (row-major) here instead of int**, so indexes are computed with size_t to handle files larger than 2^31 ints
+// C is an int file like the inputs, so sums wrap mod 2^32 just like the in-memory kernels' results (and verify_product compares mod 2^32);
+// the arithmetic is done unsigned so that wrap is well defined even for the large, arbitrary-valued files this mode is meant for
+void* multiply_panel_rows (void* rowID)
+{
+    // Convert struct back from a void* to a struct
+    rowInfo *rows = (rowInfo*) rowID;
+
+    for (int i = rows->start_row; i < rows->end_row; i++)
+    {
+        uint32_t* c_row = (uint32_t*) ooc.C + (size_t) i * size;
+
+        // Same i-k-j order as the sparse kernel so B is read a row at a time, which keeps accesses inside the mapped B panel sequential
+        for (int k = ooc.k_start; k < ooc.k_end; k++)
+        {
+            uint32_t a_value = ooc.A[(size_t) i * size + k];
+            int* b_row = ooc.B + (size_t) k * size;
+
+            for (int j = 0; j < size; j++)
+            {
+                c_row[j] += a_value * (uint32_t) b_row[j];
+            }
+        }
+    }
+
+    // Free malloc'd row memory
+    free (rows);
+
+    // Return when finished
+    pthread_exit (NULL);
+}
+
+// Thread function to compute the thread's rows of mv.out = mv.mat * mv.in for verification
+void* matvec_rows (void* rowID)
+{
+    // Convert struct back from a void* to a struct
+    rowInfo *rows = (rowInfo*) rowID;
+
+    for (int i = rows->start_row; i < rows->end_row; i++)
+    {
+        int64_t total = 0;
+
+        for (int j = 0; j < size; j++)
+        {
+            total += (int64_t) mv.mat[i][j] * mv.in[j];
+        }
+
+        mv.out[i] = total;
+    }
+
+    // Free malloc'd row memory
+    free (rows);
+
+    // Return when finished
+    pthread_exit (NULL);
+}
+
+// Function to allocate space for a matrix
+int** allocate_matrix (int size) 
+{
+    // Pointer-to-pointer memory allocated w/ malloc
+    int** mat = malloc (size * sizeof(int*));
+
+    // For loop that allocates memory to each matrix w/ malloc
+    for (int i = 0; i < size; i++)
+        mat[i] = malloc (size * sizeof(int));
+
+    // Return pointer
+    return mat;
+}
+
+// Function to free malloc'd memory
+void free_matrix (int** mat, int size) 
+{
+    for (int i = 0; i < size; i++)
+    {
+        // Free matrix array memory
+        free (mat[i]);
+    }
+        
+    // Free pointer memory
+    free (mat);
+}
+
+// Function to build a CSR matrix out of a dense one
+csrMatrix* dense_to_csr (int** mat, int size)
+{
+    csrMatrix* csr = malloc (sizeof (csrMatrix));
+
+    // First pass just counts non-zeros so we know how much to allocate
+    csr->nnz = 0;
+    for (int i = 0; i < size; i++)
+        for (int j = 0; j < size; j++)
+            if (mat[i][j] != 0)
+                csr->nnz++;
+
+    csr->row_ptr = malloc ((size + 1) * sizeof (int));
+    csr->col_idx = malloc ((csr->nnz > 0 ? csr->nnz : 1) * sizeof (int));
+    csr->values = malloc ((csr->nnz > 0 ? csr->nnz : 1) * sizeof (int));
+
+    // Error checking, make sure malloc works as expected
+    if (!csr->row_ptr || !csr->col_idx || !csr->values)
+    {
+        fprintf (stderr, "Memory allocation failed\n");
+        exit (EXIT_FAILURE);
+    }
+
+    // Second pass copies the non-zeros over in row order
+    int p = 0;
+    for (int i = 0; i < size; i++)
+    {
+        csr->row_ptr[i] = p;
+
+        for (int j = 0; j < size; j++)
+        {
+            if (mat[i][j] != 0)
+            {
+                csr->col_idx[p] = j;
+                csr->values[p] = mat[i][j];
+                p++;
+            }
+        }
+    }
+    csr->row_ptr[size] = p;
+
+    return csr;
+}
+
+// Function to free malloc'd CSR memory
+void free_csr (csrMatrix* csr)
+{
+    free (csr->row_ptr);
+    free (csr->col_idx);
+    free (csr->values);
+    free (csr);
+}
+
+// Function to fill a matrix with random values between 1 and 99, where only density_percent % of the cells end up non-zero
+void fill_random_sparse (int** mat, int size, double density_percent)
+{
+    for (int i = 0; i < size; i++)
+    {
+        for (int j = 0; j < size; j++)
+        {
+            // Roll once to decide if this cell is non-zero, then roll again for the value itself
+            if ((rand () / (double) RAND_MAX) * 100.0 < density_percent)
+                mat[i][j] = (rand () % 99) + 1;
+            else
+                mat[i][j] = 0;
+        }
+    }
+}
+
+// Split rows evenly by row count; bounds[t] to bounds[t + 1] are the rows owned by thread t and the remainder goes to the last thread
+void partition_by_rows (int* bounds, int num_threads, int size)
+{
+    int rows_per_thread = size / num_threads;
+
+    for (int t = 0; t < num_threads; t++)
+        bounds[t] = t * rows_per_thread;
+
+    bounds[num_threads] = size;
+}
+
+// Split rows so that every thread gets roughly the same number of non-zeros instead of the same number of rows
+// With skewed matrices (a few very full rows) splitting by row count leaves most threads waiting on the one with the heavy rows
+// row_ptr is sorted, so each boundary is just the first row whose starting non-zero index passes t * (nnz / num_threads)
+void partition_by_nnz (int* bounds, int num_threads, csrMatrix* csr, int size)
+{
+    int row = 0;
+
+    bounds[0] = 0;
+    for (int t = 1; t < num_threads; t++)
+    {
+        long target = ((long) csr->nnz * t) / num_threads;
+
+        while (row < size && csr->row_ptr[row] < target)
+            row++;
+
+        bounds[t] = row;
+    }
+
+    bounds[num_threads] = size;
+}
+
+// Function to calculate time taken between two clock_gettime calls
+// NOTE: kept getting negative time results, so we have to modify this part to make sure that doesn't happen
+double elapsed_seconds (struct timespec start_time, struct timespec end_time)
+{
+    // Error occurs if the end_time.tv_nsec is less than start_time.tv_nsec due to wraparound errors; if statement checks if that's the case
+    if (end_time.tv_nsec < start_time.tv_nsec) 
+    {
+        return ((end_time.tv_sec - start_time.tv_sec - 1) + (end_time.tv_nsec + 1e9 - start_time.tv_nsec) / 1e9);
+    } 
+    
+    return ((end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9);
+}
+
+// Function to zero out the result matrix so two kernels can be timed back to back on the same inputs
+void clear_result (void)
+{
+    for (int i = 0; i < size; i++)
+        memset (result[i], 0, size * sizeof (int));
+}
+
+// Create one thread per row range in bounds, have each run kernel, and return the time between the first create and the last join
+double run_row_threads (void* (*kernel) (void*), int* bounds, int num_threads)
+{
+    pthread_t threads [num_threads];
+    int return_status;
+
+    struct timespec start_time, end_time;
+    clock_gettime (CLOCK_MONOTONIC, &start_time);
+
+    for (int i = 0; i < num_threads; i++)
+    {
+        // Same as the dense path in main(): every thread gets its own malloc'd struct
+        rowInfo *rows = malloc (sizeof (rowInfo));
+
+        if (!rows) 
+        {
+            fprintf (stderr, "Memory allocation failed\n");
+            exit (EXIT_FAILURE);
+        }
+
+        rows->start_row = bounds[i];
+        rows->end_row = bounds[i + 1];
+        rows->worker = i;
+
+        return_status = pthread_create (&threads[i], NULL, kernel, rows);
+
+        if (return_status)
+        {
+            fprintf (stderr, "Thread creation error; #%d\n", return_status);
+            exit (-1);
+        }
+    }
+
+    for (int i = 0; i < num_threads; i++) 
+    {
+        pthread_join (threads[i], NULL);
+    }
+
+    clock_gettime (CLOCK_MONOTONIC, &end_time);
+
+    return elapsed_seconds (start_time, end_time);
+}
+
+// Function to compute out = mat * in using all the threads
+void threaded_matvec (int** mat, int64_t* in, int64_t* out, int num_threads)
+{
+    int bounds [num_threads + 1];
+
+    mv.mat = mat;
+    mv.in = in;
+    mv.out = out;
+
+    partition_by_rows (bounds, num_threads, size);
+    run_row_threads (matvec_rows, bounds, num_threads);
+}
+
+// Function to get the splitmix64 state for one Freivalds round's random vector; matrix is the index within a batch, 0 everywhere else
+// Every (matrix, round) pair gets its own stream derived from fill_seed, so which vectors a check uses depends only on the seed,
+// not on whatever else has drawn from rand () first
+uint64_t verify_seed (int matrix, int round)
+{
+    uint64_t state = fill_seed;
+
+    state = splitmix64 (&state) ^ (uint64_t) matrix;
+    state = splitmix64 (&state) ^ (uint64_t) round;
+
+    return state;
+}
+
+// Freivalds' check that C == A * B, run after the timed region so it never shows up in the timing results
+// Each round picks a random 0/1 vector r and compares A * (B * r) against C * r; that's three O(n^2) products instead of an O(n^3) multiply
+// If C is wrong, a round catches it with probability at least 1/2, so the chance of missing it after verify_rounds rounds is at most 2^-verify_rounds
+// Returns 1 if every round agreed, 0 (and sets verify_failed) otherwise
+int verify_product (int** A, int** B, int** C, int num_threads, const char* label)
+{
+    if (verify_rounds < 1)
+        return 1;
+
+    int64_t* r = malloc (size * sizeof (int64_t));
+    int64_t* br = malloc (size * sizeof (int64_t));
+    int64_t* abr = malloc (size * sizeof (int64_t));
+    int64_t* cr = malloc (size * sizeof (int64_t));
+
+    // Error checking, make sure malloc works as expected
+    if (!r || !br || !abr || !cr)
+    {
+        fprintf (stderr, "Memory allocation failed\n");
+        exit (EXIT_FAILURE);
+    }
+
+    int passed = 1;
+
+    for (int round = 0; round < verify_rounds && passed; round++)
+    {
+        uint64_t state = verify_seed (0, round);
+
+        for (int j = 0; j < size; j++)
+            r[j] = splitmix64 (&state) & 1;
+
+        threaded_matvec (B, r, br, num_threads);
+        threaded_matvec (A, br, abr, num_threads);
+        threaded_matvec (C, r, cr, num_threads);
+
+        // The int result matrix wraps on overflow, so compare mod 2^32 to match what the kernels can actually store
+        for (int i = 0; i < size; i++)
+        {
+            if ((uint32_t) abr[i] != (uint32_t) cr[i])
+            {
+                fprintf (stderr, "%s: verification FAILED in round %d (row %d)\n", label, round + 1, i);
+                passed = 0;
+                break;
+            }
+        }
+    }
+
+    if (passed)
+        printf ("%s: verified (%d Freivalds rounds)\n", label, verify_rounds);
+    else
+        verify_failed = 1;
+
+    free (r);
+    free (br);
+    free (abr);
+    free (cr);
+
+    return passed;
+}
+
+// Function to build an int** view of the rows of a flat row-major matrix, so mapped matrices can go through verify_product
+int** row_view (int* flat, int size)
+{
+    int** rows = malloc (size * sizeof (int*));
+
+    if (!rows)
+    {
+        fprintf (stderr, "Memory allocation failed\n");
+        exit (EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < size; i++)
+        rows[i] = flat + (size_t) i * size;
+
+    return rows;
+}
+
+// Time the dense kernel and the CSR kernel on the same matrixA at the given density
+// Both use the i-k-j loop order, so the only difference between the two times is whether the zeros get skipped
+// matrixA/matrixB/result must already be allocated; sparseA is rebuilt here and freed before returning
+void compare_dense_sparse (int num_threads, double density_percent, double* dense_time, double* sparse_time)
+{
+    int bounds [num_threads + 1];
+
+    // A is sparse at the requested density, B stays fully dense
+    fill_random_sparse (matrixA, size, density_percent);
+    fill_random_sparse (matrixB, size, 100.0);
+
+    // Building the CSR copy counts as setup, same as filling the matrices, so it's outside the timed region
+    sparseA = dense_to_csr (matrixA, size);
+
+    clear_result ();
+    partition_by_rows (bounds, num_threads, size);
+    *dense_time = run_row_threads (multiply_rows_ikj, bounds, num_threads);
+    verify_product (matrixA, matrixB, result, num_threads, "dense");
+
+    clear_result ();
+    partition_by_nnz (bounds, num_threads, sparseA, size);
+    *sparse_time = run_row_threads (multiply_sparse_rows, bounds, num_threads);
+    verify_product (matrixA, matrixB, result, num_threads, "sparse");
+
+    free_csr (sparseA);
+    sparseA = NULL;
+}
+
+// Sparse mode: one dense vs CSR comparison at a single density
+// Output format is density,dense time,sparse time
+int run_sparse (int num_threads, double density_percent)
+{
+    double dense_time, sparse_time;
+
+    FILE* output = fopen ("CMatrixMultSparseResults.txt", "a");
+
+    if (!output)
+    {
+        printf ("Error opening file");
+        exit (-1);
+    }
+
+    compare_dense_sparse (num_threads, density_percent, &dense_time, &sparse_time);
+
+    fprintf (output, "%f,%f,%f\n", density_percent, dense_time, sparse_time);
+    printf ("density %6.2f%%: dense %f s, sparse %f s\n", density_percent, dense_time, sparse_time);
+
+    fclose (output);
+
+    return 0;
+}
+
+// Sweep mode: run the dense vs CSR comparison over a range of densities and report the break-even point,
+// i.e. the lowest tested density where CSR is no longer faster than the dense kernel
+int run_sweep (int num_threads)
+{
+    double densities[] = {0.1, 0.5, 1, 2, 5, 10, 15, 20, 30, 40, 50, 60, 75, 90, 100};
+    int num_densities = sizeof (densities) / sizeof (densities[0]);
+    double break_even = -1;
+
+    FILE* output = fopen ("CMatrixMultSparseResults.txt", "a");
+
+    if (!output)
+    {
+        printf ("Error opening file");
+        exit (-1);
+    }
+
+    for (int d = 0; d < num_densities; d++)
+    {
+        double dense_time, sparse_time;
+
+        compare_dense_sparse (num_threads, densities[d], &dense_time, &sparse_time);
+
+        fprintf (output, "%f,%f,%f\n", densities[d], dense_time, sparse_time);
+        printf ("density %6.2f%%: dense %f s, sparse %f s\n", densities[d], dense_time, sparse_time);
+
+        if (break_even < 0 && sparse_time >= dense_time)
+            break_even = densities[d];
+    }
+
+    if (break_even < 0)
+        printf ("size %d: sparse was faster at every tested density\n", size);
+    else
+        printf ("size %d: break-even density ~%.2f%%\n", size, break_even);
+
+    fclose (output);
+
+    return 0;
+}
+
+// Gen mode: write a size x size matrix of random values between 0 and 99 to a matrix file
+// Written one row at a time so the file can be bigger than memory
+int run_generate (const char* path, int size)
+{
+    FILE* fp = fopen (path, "wb");
+
+    if (!fp)
+    {
+        perror ("Error Opening Matrix File");
+        return EXIT_FAILURE;
+    }
+
+    matrixFileHeader header;
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, MATRIX_FILE_MAGIC, 4);
+    header.elem_size = sizeof (int);
+    header.rows = size;
+    header.cols = size;
+
+    int* row = malloc (size * sizeof (int));
+
+    if (!row)
+    {
+        fprintf (stderr, "Memory allocation failed\n");
+        exit (EXIT_FAILURE);
+    }
+
+    if (fwrite (&header, sizeof (header), 1, fp) != 1)
+    {
+        perror ("Error Writing Matrix File");
+        free (row);
+        fclose (fp);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < size; i++)
+    {
+        for (int j = 0; j < size; j++)
+            row[j] = rand () % 100;
+
+        if (fwrite (row, sizeof (int), size, fp) != (size_t) size)
+        {
+            perror ("Error Writing Matrix File");
+            free (row);
+            fclose (fp);
+            return EXIT_FAILURE;
+        }
+    }
+
+    free (row);
+
+    // Writes are buffered, so a full disk may only show up when the last of them is flushed here
+    if (fclose (fp) != 0)
+    {
+        perror ("Error Writing Matrix File");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Function to mmap a matrix file; returns the start of the mapping (header included) or NULL on error
+// For the output file (writable != 0) the file is created and sized to hold a size x size matrix first
+void* map_matrix_file (const char* path, int writable, int* size_out, size_t* length_out)
+{
+    int fd = open (path, writable ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDONLY, 0644);
+
+    if (fd < 0)
+    {
+        perror (path);
+        return NULL;
+    }
+
+    size_t length;
+
+    if (writable)
+    {
+        length = MATRIX_HEADER_SIZE + (size_t) *size_out * *size_out * sizeof (int);
+
+        // ftruncate gives us a sparse file of zeros, which is exactly the starting value C needs
+        if (ftruncate (fd, length) != 0)
+        {
+            perror ("Error Sizing Output Matrix File");
+            close (fd);
+            return NULL;
+        }
+    }
+
+    else
+    {
+        struct stat st;
+
+        if (fstat (fd, &st) != 0 || st.st_size < MATRIX_HEADER_SIZE)
+        {
+            fprintf (stderr, "Not a matrix file: %s\n", path);
+            close (fd);
+            return NULL;
+        }
+
+        length = st.st_size;
+    }
+
+    void* map = mmap (NULL, length, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+
+    // The mapping stays valid after the descriptor is closed
+    close (fd);
+
+    if (map == MAP_FAILED)
+    {
+        perror ("Error Mapping Matrix File");
+        return NULL;
+    }
+
+    matrixFileHeader* header = (matrixFileHeader*) map;
+
+    if (writable)
+    {
+        memcpy (header->magic, MATRIX_FILE_MAGIC, 4);
+        header->elem_size = sizeof (int);
+        header->rows = *size_out;
+        header->cols = *size_out;
+    }
+
+    // Error Check: make sure an input file is really a square int matrix and isn't truncated
+    // rows has to fit the int sizes used everywhere else; capping it also keeps rows * cols * sizeof (int) from wrapping in the length check
+    else if (memcmp (header->magic, MATRIX_FILE_MAGIC, 4) != 0 || header->elem_size != sizeof (int) || header->rows != header->cols
+             || header->rows > INT_MAX || header->rows * header->cols > (SIZE_MAX - MATRIX_HEADER_SIZE) / sizeof (int)
+             || length < MATRIX_HEADER_SIZE + header->rows * header->cols * sizeof (int))
+    {
+        fprintf (stderr, "Not a valid matrix file: %s\n", path);
+        munmap (map, length);
+        return NULL;
+    }
+
+    *size_out = (int) header->rows;
+    *length_out = length;
+
+    return map;
+}
+
+// Function to check whether two paths name the same file (same device and inode, so links and different spellings of a path count too)
+// A path that doesn't exist yet can't be the same as anything
+int same_file (const char* path1, const char* path2)
+{
+    struct stat st1, st2;
+
+    if (stat (path1, &st1) != 0 || stat (path2, &st2) != 0)
+        return 0;
+
+    return st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino;
+}
+
+// Function to find the page-aligned byte range covering rows [first_row, end_row) of a flat mapped matrix
+// madvise and msync both need a page-aligned start address, so normally the range is widened out to whole pages
+// With inner set it's narrowed to the pages lying wholly inside the rows instead, for advice like DONTNEED that mustn't touch the neighbouring
+// panels' rows sharing the first or last page
+size_t row_pages (int* data, int first_row, int end_row, int inner, void** start_out)
+{
+    uintptr_t page = sysconf (_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t) (data + (size_t) first_row * size);
+    uintptr_t end = (uintptr_t) (data + (size_t) end_row * size);
+
+    if (inner)
+    {
+        start = (start + page - 1) & ~(page - 1);
+        end &= ~(page - 1);
+    }
+
+    else
+        start &= ~(page - 1);
+
+    *start_out = (void*) start;
+
+    return (end > start) ? end - start : 0;
+}
+
+// Function to madvise the rows [first_row, end_row) of a flat mapped matrix
+// DONTNEED only drops pages holding nothing but these rows; the next panel's first rows may share the last page and be read again right away
+void advise_rows (int* data, int first_row, int end_row, int advice)
+{
+    void* start;
+    size_t length = row_pages (data, first_row, end_row, advice == MADV_DONTNEED, &start);
+
+    if (length > 0)
+        madvise (start, length, advice);
+}
+
+// Function to write the rows [first_row, end_row) of a writable mapped matrix back to its file
+void sync_rows (int* data, int first_row, int end_row)
+{
+    void* start;
+    size_t length = row_pages (data, first_row, end_row, 0, &start);
+
+    if (length > 0 && msync (start, length, MS_SYNC) != 0)
+        perror ("Error Syncing Output Matrix File");
+}
+
+// Ooc mode: streaming tiled multiply of two matrix files into a third, all three mmap'd
+// A is walked one row panel at a time, and for each A panel every B row panel is streamed through
+// Only one A panel, one B panel and one C panel need to be resident at once: 3 * panel_rows * size ints must fit in the memory budget
+// While the current panel pair is being multiplied, the next B panel (or next A panel) is madvise'd WILLNEED so the kernel reads it ahead
+// Finished panels are madvise'd DONTNEED (and C panels msync'd first) so the resident set stays inside the budget
+int run_out_of_core (int num_threads, const char* pathA, const char* pathB, const char* pathC, long budget_mb)
+{
+    int sizeA, sizeB;
+    size_t lengthA, lengthB, lengthC;
+
+    // The output file gets truncated when it's mapped, so make sure it isn't one of the inputs before anything is opened
+    if (same_file (pathC, pathA) || same_file (pathC, pathB))
+    {
+        fprintf (stderr, "Output matrix file %s is also an input; refusing to overwrite it\n", pathC);
+        return EXIT_FAILURE;
+    }
+
+    void* mapA = map_matrix_file (pathA, 0, &sizeA, &lengthA);
+    void* mapB = map_matrix_file (pathB, 0, &sizeB, &lengthB);
+    void* mapC = NULL;
+
+    if (mapA && mapB && sizeA != sizeB)
+        fprintf (stderr, "Matrix sizes don't match: %d vs %d\n", sizeA, sizeB);
+
+    else if (mapA && mapB)
+    {
+        size = sizeA;
+        mapC = map_matrix_file (pathC, 1, &size, &lengthC);
+    }
+
+    // Any failure above leaves some of the inputs mapped; unmap whatever made it before giving up
+    if (!mapC)
+    {
+        if (mapA)
+            munmap (mapA, lengthA);
+
+        if (mapB)
+            munmap (mapB, lengthB);
+
+        return EXIT_FAILURE;
+    }
+
+    ooc.A = (int*) ((char*) mapA + MATRIX_HEADER_SIZE);
+    ooc.B = (int*) ((char*) mapB + MATRIX_HEADER_SIZE);
+    ooc.C = (int*) ((char*) mapC + MATRIX_HEADER_SIZE);
+
+    // Work out how many rows go in a panel; always at least 1 even if the budget is tiny
+    long panel_rows = (budget_mb * 1024 * 1024) / (3L * size * sizeof (int));
+
+    if (panel_rows < 1)
+        panel_rows = 1;
+
+    if (panel_rows > size)
+        panel_rows = size;
+
+    int bounds [num_threads + 1];
+
+    // The input files are read front to back, so tell the kernel not to bother keeping pages once we've moved past them
+    madvise (mapA, lengthA, MADV_SEQUENTIAL);
+    madvise (mapB, lengthB, MADV_SEQUENTIAL);
+
+    struct timespec start_time, end_time;
+    clock_gettime (CLOCK_MONOTONIC, &start_time);
 
-// Create structure for threads to know what rows they do work on
-typedef struct 
-{
-    int start_row;
-    int end_row;
+    for (int i0 = 0; i0 < size; i0 += panel_rows)
+    {
+        int i1 = (i0 + panel_rows < size) ? i0 + panel_rows : size;
+        int panel_size = i1 - i0;
 
-} rowInfo;
+        // Split this A panel's rows between the threads; the remainder goes to the last thread like the dense path
+        partition_by_rows (bounds, num_threads, panel_size);
+        for (int t = 0; t <= num_threads; t++)
+            bounds[t] += i0;
 
-// Thread function to compute multiple rows of the result matrix
-void* multiply_rows (void* rowID) 
+        for (int k0 = 0; k0 < size; k0 += panel_rows)
+        {
+            int k1 = (k0 + panel_rows < size) ? k0 + panel_rows : size;
+
+            // Prefetch whatever panel comes next so the page-in overlaps with this panel's compute
+            if (k1 < size)
+                advise_rows (ooc.B, k1, (k1 + panel_rows < size) ? k1 + panel_rows : size, MADV_WILLNEED);
+
+            else if (i1 < size)
+            {
+                advise_rows (ooc.A, i1, (i1 + panel_rows < size) ? i1 + panel_rows : size, MADV_WILLNEED);
+                advise_rows (ooc.B, 0, panel_rows, MADV_WILLNEED);
+            }
+
+            ooc.k_start = k0;
+            ooc.k_end = k1;
+            run_row_threads (multiply_panel_rows, bounds, num_threads);
+
+            // Done with this B panel
+            advise_rows (ooc.B, k0, k1, MADV_DONTNEED);
+        }
+
+        // C panel is finished; write it back and drop it, then drop the A panel too
+        sync_rows (ooc.C, i0, i1);
+        advise_rows (ooc.C, i0, i1, MADV_DONTNEED);
+        advise_rows (ooc.A, i0, i1, MADV_DONTNEED);
+    }
+
+    clock_gettime (CLOCK_MONOTONIC, &end_time);
+
+    double time_taken = elapsed_seconds (start_time, end_time);
+
+    // Verification reads A, B and C back through the mappings; that's O(n^2) I/O, the same order as just reading the inputs once
+    if (verify_rounds > 0)
+    {
+        int** rowsA = row_view (ooc.A, size);
+        int** rowsB = row_view (ooc.B, size);
+        int** rowsC = row_view (ooc.C, size);
+
+        verify_product (rowsA, rowsB, rowsC, num_threads, "ooc");
+
+        free (rowsA);
+        free (rowsB);
+        free (rowsC);
+    }
+
+    munmap (mapA, lengthA);
+    munmap (mapB, lengthB);
+    munmap (mapC, lengthC);
+
+    // Output format is size,memory budget in MB,panel rows,time
+    FILE* output = fopen ("CMatrixMultOOCResults.txt", "a");
+
+    if (!output)
+    {
+        printf ("Error opening file");
+        exit (-1);
+    }
+
+    fprintf (output, "%d,%ld,%ld,%f\n", size, budget_mb, panel_rows, time_taken);
+    fclose (output);
+
+    return verify_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Batched mode: lots of independent small n x n multiplies (C[b] = A[b] * B[b])
+// Matrices are stored back to back in one flat array each; matrix b starts at b * n * n, so there's no per-matrix malloc or pointer chasing
+typedef void (*batchKernel) (const int* A, const int* B, int* C);
+
+// 4x4 kernel with the k and j loops written out by hand; only the loop over rows of A is left, and each output row is four dot products
+// on values already in locals, instead of the accumulate-into-row[] pattern DEFINE_FIXED_GEMM uses for the bigger sizes
+void gemm_4x4 (const int* A, const int* B, int* C)
 {
-    // Convert struct back from a void* to a struct
-    rowInfo *rows = (rowInfo*) rowID;
+    for (int i = 0; i < 4; i++)
+    {
+        int a0 = A[i * 4 + 0], a1 = A[i * 4 + 1], a2 = A[i * 4 + 2], a3 = A[i * 4 + 3];
 
-    // For loop to track row #
-    for (int i = rows->start_row; i < rows->end_row; i++) 
+        C[i * 4 + 0] = a0 * B[0] + a1 * B[4] + a2 * B[8]  + a3 * B[12];
+        C[i * 4 + 1] = a0 * B[1] + a1 * B[5] + a2 * B[9]  + a3 * B[13];
+        C[i * 4 + 2] = a0 * B[2] + a1 * B[6] + a2 * B[10] + a3 * B[14];
+        C[i * 4 + 3] = a0 * B[3] + a1 * B[7] + a2 * B[11] + a3 * B[15];
+    }
+}
+
+// Fixed-size kernels for the other common sizes; N is a compile-time constant so the compiler can fully unroll and vectorize the j loop
+// Same i-k-j order as the sparse kernel, accumulating each row of C in a local array so C is only written once
+#define DEFINE_FIXED_GEMM(N) \
+void gemm_##N##x##N (const int* A, const int* B, int* C) \
+{ \
+    for (int i = 0; i < N; i++) \
+    { \
+        int row[N] = {0}; \
+        for (int k = 0; k < N; k++) \
+        { \
+            int a_value = A[i * N + k]; \
+            for (int j = 0; j < N; j++) \
+                row[j] += a_value * B[k * N + j]; \
+        } \
+        memcpy (C + i * N, row, sizeof (row)); \
+    } \
+}
+
+DEFINE_FIXED_GEMM (8)
+DEFINE_FIXED_GEMM (16)
+DEFINE_FIXED_GEMM (32)
+DEFINE_FIXED_GEMM (64)
+
+// Generic kernel for any other size; uses the global size as n
+void gemm_any (const int* A, const int* B, int* C)
+{
+    for (int i = 0; i < size; i++)
     {
-        // For loop to keep track of result/matrixB column #
         for (int j = 0; j < size; j++)
+            C[i * size + j] = 0;
+
+        for (int k = 0; k < size; k++)
         {
-            // Inner for loop to do the multiplication
-            for (int k = 0; k < size; k++) 
-            {
-                // NOTE: Should not need mutex locks here as each thread has it's own row to do math with, and they should not be accessing the same memory space except to read
-                result[i][j] += matrixA[i][k] * matrixB[k][j];
-            }
+            int a_value = A[i * size + k];
+
+            for (int j = 0; j < size; j++)
+                C[i * size + j] += a_value * B[k * size + j];
         }
     }
+}
+
+// Function to pick the kernel for a matrix size
+batchKernel pick_batch_kernel (int n)
+{
+    switch (n)
+    {
+        case 4:  return gemm_4x4;
+        case 8:  return gemm_8x8;
+        case 16: return gemm_16x16;
+        case 32: return gemm_32x32;
+        case 64: return gemm_64x64;
+        default: return gemm_any;
+    }
+}
+
+// Shared state for the batch thread pool
+// Threads are created once and then run every repetition, meeting at the barriers so none of the pthread_create/join cost lands in the timing
+typedef struct
+{
+    int* A;
+    int* B;
+    int* C;
+    batchKernel kernel;
+    int reps;
+    pthread_barrier_t start;
+    pthread_barrier_t finish;
+
+} batchPool;
+
+batchPool pool;
+
+// Thread function for the batch pool; start_row/end_row are the range of matrix indexes this thread owns
+// Each thread always gets the same slice of the batch, so no locks are needed, same as the row split in the other kernels
+void* batch_worker (void* rowID)
+{
+    // Convert struct back from a void* to a struct
+    rowInfo *rows = (rowInfo*) rowID;
+    size_t stride = (size_t) size * size;
+
+    for (int rep = 0; rep < pool.reps; rep++)
+    {
+        pthread_barrier_wait (&pool.start);
+
+        for (int b = rows->start_row; b < rows->end_row; b++)
+            pool.kernel (pool.A + b * stride, pool.B + b * stride, pool.C + b * stride);
+
+        pthread_barrier_wait (&pool.finish);
+    }
 
     // Free malloc'd row memory
     free (rows);
@@ -64,34 +1150,171 @@ void* multiply_rows (void* rowID)
     pthread_exit (NULL);
 }
 
-// Function to allocate space for a matrix
-int** allocate_matrix (int size) 
+// Function to Freivalds-check every matrix in the batch; same test as verify_product, but single-threaded per matrix since they're tiny
+int verify_batch (int count)
 {
-    // Pointer-to-pointer memory allocated w/ malloc
-    int** mat = malloc (size * sizeof(int*));
+    if (verify_rounds < 1)
+        return 1;
 
-    // For loop that allocates memory to each matrix w/ malloc
-    for (int i = 0; i < size; i++)
-        mat[i] = malloc (size * sizeof(int));
+    size_t stride = (size_t) size * size;
+    int64_t r[size], br[size], abr[size], cr[size];
 
-    // Return pointer
-    return mat;
+    for (int b = 0; b < count; b++)
+    {
+        const int* A = pool.A + b * stride;
+        const int* B = pool.B + b * stride;
+        const int* C = pool.C + b * stride;
+
+        for (int round = 0; round < verify_rounds; round++)
+        {
+            uint64_t state = verify_seed (b, round);
+
+            for (int j = 0; j < size; j++)
+                r[j] = splitmix64 (&state) & 1;
+
+            for (int i = 0; i < size; i++)
+            {
+                br[i] = 0;
+                cr[i] = 0;
+
+                for (int j = 0; j < size; j++)
+                {
+                    br[i] += (int64_t) B[i * size + j] * r[j];
+                    cr[i] += (int64_t) C[i * size + j] * r[j];
+                }
+            }
+
+            for (int i = 0; i < size; i++)
+            {
+                abr[i] = 0;
+
+                for (int j = 0; j < size; j++)
+                    abr[i] += (int64_t) A[i * size + j] * br[j];
+
+                if ((uint32_t) abr[i] != (uint32_t) cr[i])
+                {
+                    fprintf (stderr, "batch: verification FAILED for matrix %d in round %d (row %d)\n", b, round + 1, i);
+                    verify_failed = 1;
+                    return 0;
+                }
+            }
+        }
+    }
+
+    printf ("batch: verified (%d Freivalds rounds per matrix)\n", verify_rounds);
+
+    return 1;
 }
 
-// Function to free malloc'd memory
-void free_matrix (int** mat, int size) 
+// Batch mode: multiply count independent n x n matrix pairs, reps times over, on a persistent thread pool and report matrices per second
+// Output format is n,count,reps,time,matrices per second
+int run_batch (int num_threads, int n, int count, int reps)
 {
-    for (int i = 0; i < size; i++)
+    size = n;
+    size_t total = (size_t) count * n * n;
+
+    pool.A = malloc (total * sizeof (int));
+    pool.B = malloc (total * sizeof (int));
+    pool.C = malloc (total * sizeof (int));
+
+    if (!pool.A || !pool.B || !pool.C)
     {
-        // Free matrix array memory
-        free (mat[i]);
+        fprintf (stderr, "Memory allocation failed\n");
+        exit (EXIT_FAILURE);
     }
-        
-    // Free pointer memory
-    free (mat);
+
+    for (size_t i = 0; i < total; i++)
+    {
+        pool.A[i] = rand () % 100;
+        pool.B[i] = rand () % 100;
+    }
+
+    pool.kernel = pick_batch_kernel (n);
+    pool.reps = reps;
+
+    // Never more threads than matrices
+    if (num_threads > count)
+        num_threads = count;
+
+    // Main thread joins both barriers too, so it knows when each repetition starts and ends
+    pthread_barrier_init (&pool.start, NULL, num_threads + 1);
+    pthread_barrier_init (&pool.finish, NULL, num_threads + 1);
+
+    pthread_t threads [num_threads];
+    int bounds [num_threads + 1];
+    int return_status;
+
+    // Split the batch by matrix count, remainder to the last thread
+    partition_by_rows (bounds, num_threads, count);
+
+    for (int i = 0; i < num_threads; i++)
+    {
+        rowInfo *rows = malloc (sizeof (rowInfo));
+
+        if (!rows) 
+        {
+            fprintf (stderr, "Memory allocation failed\n");
+            exit (EXIT_FAILURE);
+        }
+
+        rows->start_row = bounds[i];
+        rows->end_row = bounds[i + 1];
+        rows->worker = i;
+
+        return_status = pthread_create (&threads[i], NULL, batch_worker, rows);
+
+        if (return_status)
+        {
+            fprintf (stderr, "Thread creation error; #%d\n", return_status);
+            exit (-1);
+        }
+    }
+
+    // Pool is up; only the repetitions themselves are timed
+    struct timespec start_time, end_time;
+    clock_gettime (CLOCK_MONOTONIC, &start_time);
+
+    for (int rep = 0; rep < reps; rep++)
+    {
+        pthread_barrier_wait (&pool.start);
+        pthread_barrier_wait (&pool.finish);
+    }
+
+    clock_gettime (CLOCK_MONOTONIC, &end_time);
+
+    for (int i = 0; i < num_threads; i++) 
+    {
+        pthread_join (threads[i], NULL);
+    }
+
+    double time_taken = elapsed_seconds (start_time, end_time);
+    double rate = ((double) count * reps) / time_taken;
+
+    verify_batch (count);
+
+    FILE* output = fopen ("CMatrixMultBatchResults.txt", "a");
+
+    if (!output)
+    {
+        printf ("Error opening file");
+        exit (-1);
+    }
+
+    fprintf (output, "%d,%d,%d,%f,%f\n", n, count, reps, time_taken, rate);
+    printf ("%dx%d batch of %d, %d reps: %f s, %.0f matrices/s\n", n, n, count, reps, time_taken, rate);
+
+    fclose (output);
+
+    pthread_barrier_destroy (&pool.start);
+    pthread_barrier_destroy (&pool.finish);
+    free (pool.A);
+    free (pool.B);
+    free (pool.C);
+
+    return verify_failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
-int main () 
+int main (int argc, char* argv[]) 
 {
     // Determine number of CPU cores to find max number of threads
     // Then initialize thread array to hold that many
@@ -99,6 +1322,119 @@ int main ()
     int num_threads = sysconf (_SC_NPROCESSORS_ONLN);
     pthread_t threads [num_threads];
 
+    fill_seed = time (NULL);
+
+    // Optional flags before the mode; shift them off argv so the mode parsing below is unchanged
+    // -v <rounds> turns on Freivalds verification of every multiply, -s <seed> makes the random matrices repeatable
+    while (argc > 2 && (strcmp (argv[1], "-v") == 0 || strcmp (argv[1], "-s") == 0))
+    {
+        if (strcmp (argv[1], "-v") == 0)
+            verify_rounds = atoi (argv[2]);
+
+        else
+            fill_seed = strtoull (argv[2], NULL, 10);
+
+        argc -= 2;
+        argv += 2;
+
+        // Keep the program name in argv[0] for the usage messages
+        argv[0] = argv[-2];
+    }
+
+    // File-based modes don't use the in-memory matrices at all
+    if (argc > 1 && strcmp (argv[1], "gen") == 0)
+    {
+        if (argc < 4 || atoi (argv[3]) < 1)
+        {
+            fprintf (stderr, "Usage:\n %s %s\n", argv[0], USAGE);
+            return EXIT_FAILURE;
+        }
+
+        srand (fill_seed);
+
+        return run_generate (argv[2], atoi (argv[3]));
+    }
+
+    if (argc > 1 && strcmp (argv[1], "ooc") == 0)
+    {
+        if (argc < 6 || atol (argv[5]) < 1)
+        {
+            fprintf (stderr, "Usage:\n %s %s\n", argv[0], USAGE);
+            return EXIT_FAILURE;
+        }
+
+        return run_out_of_core (num_threads, argv[2], argv[3], argv[4], atol (argv[5]));
+    }
+
+    if (argc > 1 && strcmp (argv[1], "batch") == 0)
+    {
+        if (argc < 4 || atoi (argv[2]) < 1 || atoi (argv[3]) < 1)
+        {
+            fprintf (stderr, "Usage:\n %s %s\n", argv[0], USAGE);
+            return EXIT_FAILURE;
+        }
+
+        srand (fill_seed);
+
+        return run_batch (num_threads, atoi (argv[2]), atoi (argv[3]), (argc > 4 && atoi (argv[4]) > 0) ? atoi (argv[4]) : 1);
+    }
+
+    // Optional mode argument; no argument (or "dense") keeps the original dense benchmark below
+    // Sparse modes take the matrix size from the command line since they're meant for much larger matrices
+    if (argc > 1 && strcmp (argv[1], "dense") != 0)
+    {
+        int sparse_mode = (strcmp (argv[1], "sparse") == 0);
+        int sweep_mode = (strcmp (argv[1], "sweep") == 0);
+
+        // Error Check: Check Arguments
+        if ((!sparse_mode && !sweep_mode) || (sparse_mode && argc < 4) || (sweep_mode && argc < 3))
+        {
+            fprintf (stderr, "Usage:\n %s %s\n", argv[0], USAGE);
+            return EXIT_FAILURE;
+        }
+
+        size = atoi (argv[2]);
+
+        if (size < 1)
+        {
+            fprintf (stderr, "Invalid size: %s\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+
+        // Density is a percentage of nonzeros; the whole argument has to parse, and 0 (or NaN) would leave nothing to multiply
+        double density = 0;
+
+        if (sparse_mode)
+        {
+            char* end;
+            density = strtod (argv[3], &end);
+
+            if (end == argv[3] || *end != '\0' || !(density > 0 && density <= 100))
+            {
+                fprintf (stderr, "Invalid density: %s (must be a percentage greater than 0 and at most 100)\n", argv[3]);
+                fprintf (stderr, "Usage:\n %s %s\n", argv[0], USAGE);
+                return EXIT_FAILURE;
+            }
+        }
+
+        matrixA = allocate_matrix (size);
+        matrixB = allocate_matrix (size);
+        result = allocate_matrix (size);
+
+        srand (fill_seed);
+
+        int status = sparse_mode ? run_sparse (num_threads, density) : run_sweep (num_threads);
+
+        if (verify_failed)
+            status = EXIT_FAILURE;
+
+        free_matrix (matrixA, size);
+        free_matrix (matrixB, size);
+        free_matrix (result, size);
+
+        return status;
+    }
+
     // Calculate how worload is divided by thread, remained will be given to the last thread
     int rows_per_thread = size / num_threads;
     int remainder = size % num_threads;
@@ -106,14 +1442,14 @@ int main ()
     // Initialize pthread_create value holder
     int return_status;
 
+    // Memory instrumentation (only with -DMEMSTATS); one line per phase in CMatrixMultMemory.txt
+    memstats_begin ();
+
     // Allocate and initialize matrix pointers/matrices
     matrixA = allocate_matrix (size);
     matrixB = allocate_matrix (size);
     result = allocate_matrix (size);
 
-    // Initialize srand with time as the seed
-    srand (time (NULL));
-
     // Output file for results:
     FILE* output = fopen ("CMatrixMultResults.txt", "a");
    
@@ -124,22 +1460,36 @@ int main ()
         exit (-1);
     }
 
-    // Double for loop that fills both initial matrices and final matrix with random values between 0 and 99, and 0 respectively
-    for (int i = 0; i < size; i++)
+    // Fill both initial matrices with random values between 0 and 99 and the final matrix with 0, split across threads by rows like the multiply
+    // This used to be one serial rand () loop that took longer than the multiply itself at large sizes; it's timed on its own so it stays out of the
+    // multiply time, and appended to CMatrixMultSetup.txt along with the seed so a run can be reproduced with -s
+    // Output format is size,threads,seed,setup time
+    int fill_bounds [num_threads + 1];
+    partition_by_rows (fill_bounds, num_threads, size);
+
+    double setup_time = run_row_threads (fill_rows, fill_bounds, num_threads);
+    FILE* setup_output = fopen ("CMatrixMultSetup.txt", "a");
+
+    if (setup_output)
     {
-        for (int j = 0; j < size; j++) 
-        {
-            matrixA[i][j] = rand () % 100;
-            matrixB[i][j] = rand () % 100;
-            result[i][j] = 0;
-        }
+        fprintf (setup_output, "%d,%d,%llu,%f\n", size, num_threads, (unsigned long long) fill_seed, setup_time);
+        fclose (setup_output);
     }
 
+    memstats_phase ("CMatrixMultMemory.txt", "setup");
+
     // Initialize clock struct and start timing
     // Code borrowed from CSCI440 github repo timing.c example
     struct timespec start_time, end_time;
     clock_gettime(CLOCK_MONOTONIC, &start_time);
 
+    // Overhead breakdown bookkeeping; when each thread was created, and when it started/finished its rows
+    double spawned_at [num_threads];
+    double started [num_threads], finished [num_threads];
+    worker_start = started;
+    worker_end = finished;
+    double spawn_begin = breakdown_now ();
+
     // For loop to create threads; each thread handles one row of the matrix multiplication
     // This should hopefully avoid the need for mutex locks to increase performance
     for (int i = 0; i < num_threads; i++) 
@@ -162,6 +1512,9 @@ int main ()
         if (i == num_threads - 1)
             rows->end_row += remainder;
 
+        rows->worker = i;
+        spawned_at[i] = breakdown_now ();
+
         // Create thread, thread will call function to multiply row
         // Note that each thread get's its own malloc'd struct, so they are not sharing memory
         return_status = pthread_create (&threads[i], NULL, multiply_rows, rows);
@@ -174,6 +1527,8 @@ int main ()
         }
     }
 
+    double spawn_end = breakdown_now ();
+
     // Join threads after completion
     for (int i = 0; i < num_threads; i++) 
     {
@@ -182,32 +1537,53 @@ int main ()
 
     // Finish timer
     clock_gettime (CLOCK_MONOTONIC, &end_time);
+    double gather_end = breakdown_now ();
+    memstats_phase ("CMatrixMultMemory.txt", "compute");
+
+    worker_start = NULL;
+    worker_end = NULL;
 
     // Calculate time taken
-    // NOTE: kept getting negative time results, so we have to modify this part to make sure that doesn't happen
-    double time_taken; // = ((end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec)) / 1e9;
+    double time_taken = elapsed_seconds (start_time, end_time);
 
-    // Error occurs if the end_time.tv_nsec is less than start_time.tv_nsec due to wraparound errors; if statement checks if that's the case
-    if (end_time.tv_nsec < start_time.tv_nsec) 
-    {
-        time_taken = ((end_time.tv_sec - start_time.tv_sec - 1) + (end_time.tv_nsec + 1e9 - start_time.tv_nsec)) / 1e9;
-    } 
-    
-    else 
-    {
-        time_taken = ((end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec)) / 1e9;
-    }
+    // Check the result outside the timed region
+    verify_product (matrixA, matrixB, result, num_threads, "dense");
+
+    if (verify_rounds > 0)
+        memstats_phase ("CMatrixMultMemory.txt", "verify");
 
     // Output time to results file
     fprintf(output, "%f\n", time_taken);
 
     // Need to free memory due to malloc use
+    // The verification above sits between gather and teardown, so it's left out of the breakdown by starting teardown here
+    double teardown_begin = breakdown_now ();
+
     free_matrix(matrixA, size);
     free_matrix(matrixB, size);
     free_matrix(result, size);
 
+    double teardown_end = breakdown_now ();
+    memstats_phase ("CMatrixMultMemory.txt", "teardown");
+
+    // Distribute is how long each thread took to get going after its pthread_create call; threads share the matrices, so there's nothing to copy
+    double distribute = 0, last_finish = 0;
+    double compute_min, compute_avg, compute_max;
+
+    for (int i = 0; i < num_threads; i++)
+    {
+        distribute += (started[i] - spawned_at[i]) / num_threads;
+
+        if (finished[i] > last_finish)
+            last_finish = finished[i];
+    }
+
+    breakdown_compute_stats (started, finished, num_threads, &compute_min, &compute_avg, &compute_max);
+    breakdown_write ("CMatrixMultBreakdown.txt", num_threads, spawn_end - spawn_begin, distribute, compute_min, compute_avg, compute_max,
+                     gather_end - last_finish, teardown_end - teardown_begin, (gather_end - spawn_begin) + (teardown_end - teardown_begin));
+
     // Close time output file
     fclose (output);
 
-    return 0;
+    return verify_failed ? EXIT_FAILURE : 0;
 }
\ No newline at end of file
@@ -16,6 +16,10 @@
 import random
 import multiprocessing as mp
 import time
+import os
+
+import breakdown
+import memstats
 
  # We want to figure out the max number of processes we can run based on CPU cores, which we can do with cpu_count ()
  # Size is the variable we change to vary the difficulty of the program. 64, 256, and 512 are the testing sizes
@@ -55,7 +59,20 @@ def multiply_rows (start_row, end_row, matrixA, matrixB):
     return final_rows_result
 
 
+# Same as multiply_rows, but also returns which process ran it and when it started/finished, for the overhead breakdown
+# The clock is time.monotonic_ns, which is system-wide on Linux, so times from different processes can be compared with the parent's
+def timed_multiply_rows (start_row, end_row, matrixA, matrixB):
+    compute_start = time.monotonic_ns ()
+    rows = multiply_rows (start_row, end_row, matrixA, matrixB)
+    compute_end = time.monotonic_ns ()
+
+    return (os.getpid (), compute_start, compute_end, rows)
+
+
 if __name__ == '__main__':
+    # Memory instrumentation (only with MEMSTATS=1); one line per phase in PyMatrixMultMemory.txt
+    memstats.begin ()
+
     # Generate random seed based on current time
     random.seed (time.time ())
 
@@ -78,33 +95,52 @@ if __name__ == '__main__':
     # We created an array of arguments to pass in with each process; this is to pass multiple arguments in to the process' function without needing a shared struct
     # Since the logic is still the same as the C version (and bestcount.c), we shouldn't need locks even if we're using shared memory for multiprocessing as none of them write to the same region of memory
     for i in range (PROCESSES):
-        end = start + rows_per_process + (1 if i == PROCESSES - 1 else 0)
+        end = start + rows_per_process + (remainder if i == PROCESSES - 1 else 0)
         args.append ((start, end, matrixA, matrixB))
         start = end
 
+    memstats.phase ("PyMatrixMultMemory.txt", "setup")
+
     # Start timer
     start_time = time.time_ns ()
+    spawn_begin = time.monotonic_ns ()
 
     # mp.Pool creates a 'pool' of processes, similar to threads
     # Here, it loops through each set of rows, assigning a process to that set. Since we use global values, we don't need the return value that pool.map usually generates
     # Starmap is used as it's better than map for passing this information back and forth
     with mp.Pool (processes = PROCESSES) as pool:
-        results = pool.starmap (multiply_rows, args)
+        spawn_end = time.monotonic_ns ()
+        timed_results = pool.starmap (timed_multiply_rows, args)
+        map_end = time.monotonic_ns ()
+
+    teardown_end = time.monotonic_ns ()
+
+    # Compute ends once the pool has closed, so the workers have exited and their faults/RSS can be counted
+    memstats.phase ("PyMatrixMultMemory.txt", "compute")
 
     # Reconstruct final result matrix using rows returned from processes,
     # Similar to bestcout.c, we use the return value of the processes instead of modifying the shared data with them
     result = [None] * SIZE
-    for final_rows_result in results:
+    for _, _, _, final_rows_result in timed_results:
         for row_index, row_data in final_rows_result:
             result[row_index] = row_data
 
     # End timer and calculate time taken
     end_time = time.time_ns ()
-    time_taken = (end_time - start_time) / (1e9)
-
-    # Define and open output file to store results in
-    with open ("PyMatrixMultResults.txt", "a") as output:
-        output.write (f"{time_taken:.6f}\n")
+    gather_end = time.monotonic_ns ()
+    memstats.phase ("PyMatrixMultMemory.txt", "gather")
+
+    # Overhead breakdown: spawn is the Pool start-up, distribute is how long after the starmap call each task actually started (pickling the
+    # matrices and sending them through the pool's pipes), gather is getting the rows back (pickling them home plus rebuilding the matrix),
+    # and teardown is shutting the pool down
+    # Timing files are skipped when memory instrumentation is on, since tracemalloc and the phase bookkeeping inflate the times
+    if not memstats.ENABLED:
+        breakdown.write_breakdown ("PyMatrixMultBreakdown.txt", timed_results, spawn_begin, spawn_end, spawn_end, map_end, teardown_end, gather_end)
+        time_taken = (end_time - start_time) / (1e9)
+
+        # Define and open output file to store results in
+        with open ("PyMatrixMultResults.txt", "a") as output:
+            output.write (f"{time_taken:.6f}\n")
 
 
 
@@ -16,18 +16,127 @@ Resources used:
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h> 
+#include <time.h>
+#include <stdint.h>
+#include <endian.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/time.h>
 #include <unistd.h>
 
+#include "breakdown.h"
+#include "memstats.h"
+
+#define USAGE "[run <samples> [<checkpoint file> [<checkpoint seconds>]] | resume <checkpoint file> | coordinator <unix:path | tcp:[host:]port> <total samples> <lease size> | worker <unix:path | tcp:host:port>]"
+
 // TOT_COUNT is the variable we change to vary the difficulty of the program. 10 million, 50 million, and 100 million are the different tested values
-#define TOT_COUNT 100000000    
+// It's a 64-bit global now so the run mode can set it at runtime and go past the ~2 billion samples an int can count; DEFAULT_TOT_COUNT is used with no arguments
+#define DEFAULT_TOT_COUNT 100000000
+uint64_t TOT_COUNT = DEFAULT_TOT_COUNT;
+
+// Threads publish their progress every CHUNK_SAMPLES samples; that's what progress output and checkpoints see
+#define CHUNK_SAMPLES 1000000
+#define CHECKPOINT_MAGIC "MCCKPT1"
+
+// Most threads a checkpoint may ask for; anything bigger is a corrupt or hand-edited file, not a machine we ran on
+#define MAX_CHECKPOINT_THREADS 4096
 
 // Global variable; used to be #define NUM_THREADS but if we're taking in to account the number of threads allowed
 // by the system, we have to use global variables as #define needs values to be defined at runtime
 // We initialize it to zero here so we can assign value later
 int NUM_THREADS = 0;
 
+// Per-thread state: how many samples the thread owns, how far it's gotten, its in-circle count so far and its rand_r state
+// Saving all four is enough to resume a thread exactly where it left off, so a resumed run gives the same answer as an uninterrupted one
+typedef struct
+{
+   uint64_t target;
+   uint64_t done;
+   uint64_t in_count;
+   int seed;
+
+   // Overhead breakdown only; when the thread was created and when it started/finished sampling (not saved in checkpoints)
+   double spawned_at;
+   double compute_start;
+   double compute_end;
+
+} threadState;
+
+threadState* states;
+pthread_mutex_t state_lock = PTHREAD_MUTEX_INITIALIZER;   // Protects states[] and threads_finished; taken once per chunk, so it's basically never contended
+int threads_finished = 0;
+
+// Set by SIGINT/SIGTERM in run/resume mode so main can write a last checkpoint before exiting
+volatile sig_atomic_t stop_requested = 0;
+
+// Distributed mode settings
+// Workers report progress every PROGRESS_CHUNK samples; a lease with no progress for LEASE_TIMEOUT_SEC seconds is handed to someone else
+#define PROGRESS_CHUNK 1000000
+#define LEASE_TIMEOUT_SEC 5
+#define MAX_WORKERS 256
+
+// Message types for the coordinator/worker protocol
+// Every message is a fixed-size mcMessage, sent big-endian so workers on other hosts don't have to match byte order
+#define MSG_REQUEST 1     // worker -> coordinator: give me a lease
+#define MSG_LEASE 2       // coordinator -> worker: lease_id, a = first sample, b = sample count, c = RNG seed
+#define MSG_PROGRESS 3    // worker -> coordinator: lease_id, a = samples done so far, b = in-circle count so far
+#define MSG_COMPLETE 4    // worker -> coordinator: lease_id, a = samples done, b = in-circle count
+#define MSG_WAIT 5        // coordinator -> worker: nothing to hand out right now, ask again shortly
+#define MSG_DONE 6        // coordinator -> worker: every lease is finished, exit
+#define MSG_CANCEL 7      // coordinator -> worker: lease_id was finished by another copy, drop it and ask for more work
+
+typedef struct
+{
+    uint32_t type;
+    uint32_t lease_id;
+    uint64_t a;
+    uint64_t b;
+    uint64_t c;
+
+} mcMessage;
+
+// Lease states
+#define LEASE_PENDING 0
+#define LEASE_ACTIVE 1
+#define LEASE_DONE 2
+
+// One lease is one contiguous range of sample indexes with its own seed
+// Because the seed belongs to the lease (not the worker), re-running a lease anywhere gives the exact same count,
+// so the coordinator can hand a slow lease to a second worker and just take whichever COMPLETE shows up first
+typedef struct
+{
+    int state;
+    uint64_t start;
+    uint64_t count;
+    uint32_t seed;
+
+    int owner;                  // Worker id currently reporting progress for this lease, -1 if none
+    int backup;                 // Worker id running a duplicate copy of this lease, -1 if none
+    time_t last_progress;       // Last time the owner reported in; used to spot dead or stuck workers
+
+    uint64_t partial_samples;   // Streamed progress from the owner, only used for the live estimate
+    uint64_t partial_in;
+    uint64_t in_count;          // Final count once the lease is done
+
+} mcLease;
+
+// Coordinator's view of one worker connection; messages can arrive a few bytes at a time, so each one keeps its own receive buffer
+typedef struct
+{
+    int id;
+    size_t rx_len;
+    unsigned char rx[sizeof (mcMessage)];
+
+} mcConn;
+
 // We need to generate random numbers for the Monte Carlo Pi estimation, and they must be between 0 and 1
 float getRandomNum (int* seed)
 {
@@ -37,80 +146,217 @@ float getRandomNum (int* seed)
    return rand_r (seed) / (float) RAND_MAX;
 }
 
+// Function to run samples Monte Carlo samples with the given seed and return how many landed inside the circle
+uint64_t sample_in_circle (uint64_t samples, int* seed)
+{
+   uint64_t in_count = 0;
+
+   for (uint64_t i = 0; i < samples; i++)
+   {
+      // Generate two random floats between 0 and 1
+      float x = getRandomNum (seed);
+      float y = getRandomNum (seed);
+
+      // Square each, add them, and then take the square root
+      // If the result is less than 1, it's inside the cirle
+      if (sqrt ((x * x) + (y * y)) < 1)
+         in_count++;
+   }
+
+   return in_count;
+}
+
 // The function called when a thread is created to do the Monte Carlo calculations
-// NOTE: There are no mutex locks in this program. This is due to the fact we are attempting to use a similar logic as bestcount.c where we use local counters
-// and only access the shared counter once for each thread, after it's been joined
-// We are attempting this for two reasons: 1 - The function only needs to return an int value, so it should be relatively simple, and 2 - It should speed up the performance
+// NOTE: We are still attempting to use a similar logic as bestcount.c where we use local counters; the only shared access is
+// copying the local counters into the thread's own states[] entry once every CHUNK_SAMPLES samples, so progress and checkpoints can see them
+// The thread's target, starting count and seed are set up by main before the thread starts (fresh, or loaded from a checkpoint)
 void *monteCarloPi (void *threadID)
 {   
-   // Convert threadID back to an int, used once below. Had to do (int)(long) as (int) caused errors
+   // Convert threadID back to an int. Had to do (int)(long) as (int) caused errors
    int tid = (int)(long) threadID;    
 
-   // Initialize counter, and allocate malloc'd space for it. Has to be pointer to fit void * return type of function
-   int* in_count = malloc (sizeof (int));
-   *in_count = 0;
-   
-   // Divide total number of iterations by number of current threads to figure out how many times each thread should run
-   int iterations = TOT_COUNT / NUM_THREADS;
-   
-   // Generate thread-unique seed for true random numbers, suggested example used clock value to the power of threadID mulitplied by a large number
-   int seed = (int)(time (NULL) ^ (tid * 50));
+   threadState *state = &states[tid];
+
+   // Only this thread writes its own timing fields, and main reads them after the join
+   state->compute_start = breakdown_now ();
 
-   // The actual calculations
-   for (int i = 0; i < iterations; i++)
+   // Local copies; main doesn't touch states[tid] while we're running, so reading without the lock is fine
+   uint64_t target = state->target;
+   uint64_t done = state->done;
+   uint64_t in_count = state->in_count;
+   int seed = state->seed;
+
+   // The actual calculations, one chunk at a time
+   while (done < target)
    {
-      // Generate two random floats between 0 and 1
-      float x = getRandomNum (&seed);
-      float y = getRandomNum (&seed);
-      
-      // Square each, add them, and then take the square root
-      // If the result is less than 1, it's inside the cirle
-      if (sqrt ((x * x) + (y * y)) < 1)
+      uint64_t chunk = (target - done < CHUNK_SAMPLES) ? target - done : CHUNK_SAMPLES;
+
+      in_count += sample_in_circle (chunk, &seed);
+      done += chunk;
+
+      pthread_mutex_lock (&state_lock);
+      state->done = done;
+      state->in_count = in_count;
+      state->seed = seed;
+      pthread_mutex_unlock (&state_lock);
+   }
+
+   state->compute_end = breakdown_now ();
+
+   pthread_mutex_lock (&state_lock);
+   threads_finished++;
+   pthread_mutex_unlock (&state_lock);
+
+   // Exit thread; the count is in states[tid]
+   pthread_exit (NULL);    
+}
+
+// Function to calculate time taken between two clock_gettime calls
+double elapsed_seconds (struct timespec time_start, struct timespec time_end)
+{
+   // Error occurs if the end_time.tv_nsec is less than start_time.tv_nsec due to wraparound errors; if statement checks if that's the case
+   if (time_end.tv_nsec < time_start.tv_nsec) 
+   {
+      return (time_end.tv_sec - time_start.tv_sec - 1) + (time_end.tv_nsec + 1e9 - time_start.tv_nsec) / 1e9;
+   } 
+
+   return (time_end.tv_sec - time_start.tv_sec) + (time_end.tv_nsec - time_start.tv_nsec) / 1e9;
+}
+
+// Function to write every thread's state to a checkpoint file
+// Written to a temp file, fsync'd and renamed over the old one, so a crash mid-write never leaves a half-written checkpoint behind
+// Format is text: a header line (magic, total samples, thread count, seconds of compute so far), then "target done in_count seed" per thread
+int write_checkpoint (const char* path, double elapsed)
+{
+   char tmp_path[4096];
+   snprintf (tmp_path, sizeof (tmp_path), "%s.tmp", path);
+
+   FILE* fp = fopen (tmp_path, "w");
+
+   if (!fp)
+   {
+      perror ("Error Opening Checkpoint File");
+      return -1;
+   }
+
+   // Snapshot everything under the lock so all threads are from the same moment
+   pthread_mutex_lock (&state_lock);
+
+   fprintf (fp, "%s %llu %d %f\n", CHECKPOINT_MAGIC, (unsigned long long) TOT_COUNT, NUM_THREADS, elapsed);
+
+   for (int t = 0; t < NUM_THREADS; t++)
+   {
+      fprintf (fp, "%llu %llu %llu %d\n", (unsigned long long) states[t].target, (unsigned long long) states[t].done,
+               (unsigned long long) states[t].in_count, states[t].seed);
+   }
+
+   pthread_mutex_unlock (&state_lock);
+
+   int failed = (fflush (fp) != 0 || fsync (fileno (fp)) != 0);
+   failed |= (fclose (fp) != 0);
+
+   if (failed || rename (tmp_path, path) != 0)
+   {
+      perror ("Error Writing Checkpoint File");
+      return -1;
+   }
+
+   return 0;
+}
+
+// Function to load a checkpoint; sets TOT_COUNT and NUM_THREADS, allocates states[] and returns the seconds of compute already done (-1 on error)
+double read_checkpoint (const char* path)
+{
+   FILE* fp = fopen (path, "r");
+
+   if (!fp)
+   {
+      perror ("Error Opening Checkpoint File");
+      return -1;
+   }
+
+   char magic[16];
+   unsigned long long total;
+   double elapsed;
+
+   if (fscanf (fp, "%15s %llu %d %lf", magic, &total, &NUM_THREADS, &elapsed) != 4 || strcmp (magic, CHECKPOINT_MAGIC) != 0 || NUM_THREADS < 1
+       || NUM_THREADS > MAX_CHECKPOINT_THREADS || total == 0)
+   {
+      fprintf (stderr, "Not a checkpoint file: %s\n", path);
+      fclose (fp);
+      return -1;
+   }
+
+   TOT_COUNT = total;
+   states = calloc (NUM_THREADS, sizeof (threadState));
+
+   if (!states)
+   {
+      fprintf (stderr, "Memory allocation failed\n");
+      exit (EXIT_FAILURE);
+   }
+
+   // Every thread's line has to be self-consistent and the targets have to add up to the total, or the resumed estimate would be meaningless
+   uint64_t targets = 0;
+
+   for (int t = 0; t < NUM_THREADS; t++)
+   {
+      unsigned long long target, done, in_count;
+
+      if (fscanf (fp, "%llu %llu %llu %d", &target, &done, &in_count, &states[t].seed) != 4 || done > target || in_count > done
+          || target > TOT_COUNT - targets)
       {
-         // If inside the circle, iterate the count
-         (*in_count)++;
+         fprintf (stderr, "Corrupt checkpoint file: %s\n", path);
+         fclose (fp);
+         return -1;
       }
+
+      states[t].target = target;
+      states[t].done = done;
+      states[t].in_count = in_count;
+      targets += target;
    }
-   
-   // In the case that the total number of iterations doesn't divide equally amongst number of threads, the first thread will handle the remainder
-   // If this is the first thread created:
-   if (tid == 0)
-   {
-      // Find total remaining amount of iterations
-      int remainder = TOT_COUNT % NUM_THREADS;
-      
-      // Same code as above, but for the remainder
-      for (int q = 0; q < remainder; q++)
-      {
-         float x = getRandomNum (&seed);
-         float y = getRandomNum (&seed);
-         
-         float result = sqrt ((x * x) + (y * y));
-         
-         if (result < 1)
-         {
-            (*in_count)++;
-         }
-      }
+
+   fclose (fp);
+
+   if (targets != TOT_COUNT)
+   {
+      fprintf (stderr, "Corrupt checkpoint file: %s\n", path);
+      return -1;
    }
-   
-   // Exit thread, returning the count
-   pthread_exit (in_count);    
+
+   return elapsed;
 }
 
-int main (int argc, char *argv[])
+// Function called on SIGINT/SIGTERM in run/resume mode
+void request_stop (int sig)
 {
-   // Initialize variables; number of cores in computer, thread array, thread creation return value, thread function return value, and aggregate of function return value, respectively
-   // Thread count from Assignment 5 EC
-   NUM_THREADS = sysconf (_SC_NPROCESSORS_ONLN);
-   pthread_t threads[NUM_THREADS];
+   (void) sig;
+
+   stop_requested = 1;
+}
+
+// Function to run the threaded estimate over whatever is in states[]
+// With a checkpoint path, main prints progress every second and checkpoints every checkpoint_interval seconds while the threads run;
+// without one it just joins the threads like the original program did
+// prior_elapsed is compute time from before a resume, so the reported time covers the whole run
+// Returns 0 when the run finished, 1 if it was stopped early (after writing a checkpoint)
+int run_estimate (const char* checkpoint_path, int checkpoint_interval, double prior_elapsed, int show_progress)
+{
+   // On the heap, since a resumed run's thread count comes from the checkpoint rather than this machine
+   pthread_t* threads = malloc (NUM_THREADS * sizeof (pthread_t));
    int return_status;
-   void *value;
-   float in_circle = 0;
-   
 
+   if (!threads)
+   {
+      fprintf (stderr, "Memory allocation failed\n");
+      exit (EXIT_FAILURE);
+   }
+
+   
    // Output file for results:
-   FILE* output = fopen ("CMonteCarloResults.txt", "a");
+   // run/resume can be any size, so they go to their own file with the sample count instead of mixing into the fixed-size benchmark's results
+   FILE* output = fopen (show_progress ? "CMonteCarloRunResults.txt" : "CMonteCarloResults.txt", "a");
    
    // Make sure results file actually opened:
    if (!output)
@@ -123,10 +369,13 @@ int main (int argc, char *argv[])
    // Code borrowed from CSCI440 github repo timing.c example
    struct timespec time_start, time_end;
    clock_gettime (CLOCK_MONOTONIC, &time_start);
+   double spawn_begin = breakdown_now ();
    
    // Loop to create threads
    for (int t = 0; t < NUM_THREADS; t++)
    {
+      states[t].spawned_at = breakdown_now ();
+
       // Create thread and make it perform the Monte Carlo Pi estimation, have to cast t to long to match pointer sizes
       return_status = pthread_create (&threads[t], NULL, monteCarloPi, (void *) (long)t);
 
@@ -138,43 +387,895 @@ int main (int argc, char *argv[])
       }
    }
 
+   double spawn_end = breakdown_now ();
+
+   // Progress/checkpoint loop; wakes up every 100ms to check whether the threads are done or we've been asked to stop
+   if (show_progress)
+   {
+      struct timespec now, last_report = time_start, last_checkpoint = time_start;
+      uint64_t last_done = 0;
+
+      pthread_mutex_lock (&state_lock);
+      for (int t = 0; t < NUM_THREADS; t++)
+         last_done += states[t].done;
+      pthread_mutex_unlock (&state_lock);
+
+      while (1)
+      {
+         usleep (100000);
+         clock_gettime (CLOCK_MONOTONIC, &now);
+
+         pthread_mutex_lock (&state_lock);
+         int finished = (threads_finished == NUM_THREADS);
+         uint64_t done = 0, in_circle = 0;
+         for (int t = 0; t < NUM_THREADS; t++)
+         {
+            done += states[t].done;
+            in_circle += states[t].in_count;
+         }
+         pthread_mutex_unlock (&state_lock);
+
+         if (finished)
+            break;
+
+         if (stop_requested)
+         {
+            double elapsed = prior_elapsed + elapsed_seconds (time_start, now);
+
+            if (checkpoint_path && write_checkpoint (checkpoint_path, elapsed) == 0)
+               printf ("stopped at %llu samples, checkpoint written to %s\n", (unsigned long long) done, checkpoint_path);
+
+            else
+               printf ("stopped at %llu samples\n", (unsigned long long) done);
+
+            fclose (output);
+
+            // Threads are still running; returning from main ends them
+            return 1;
+         }
+
+         double since_report = elapsed_seconds (last_report, now);
+
+         if (since_report >= 1.0)
+         {
+            printf ("%llu/%llu samples (%.1f%%), pi ~ %.10f, %.2f M samples/s\n", (unsigned long long) done, (unsigned long long) TOT_COUNT,
+                    100.0 * done / TOT_COUNT, done ? 4.0 * in_circle / done : 0, (done - last_done) / since_report / 1e6);
+            fflush (stdout);
+
+            last_report = now;
+            last_done = done;
+         }
+
+         if (checkpoint_path && elapsed_seconds (last_checkpoint, now) >= checkpoint_interval)
+         {
+            write_checkpoint (checkpoint_path, prior_elapsed + elapsed_seconds (time_start, now));
+            last_checkpoint = now;
+         }
+      }
+   }
+
    // After threads are done, join them back together
    for (int i = 0; i < NUM_THREADS; i++)
    {     
-      // Join threads together, taking value returned from monteCarloPi function
-      pthread_join (threads[i], &value);
-      
-      // Add returned value to total sum of in-circle, casting value to int first
-      in_circle += *(int*) value;         
-      
-      // Free malloc'd memory
-      free (value);
+      pthread_join (threads[i], NULL);
    }
 
+   free (threads);
+
    // Finish timer as work is done
    clock_gettime (CLOCK_MONOTONIC, &time_end);
 
-   // Calculate time taken
-   // NOTE: kept getting negative time results, so we have to modify this part to make sure that doesn't happen
-   double time_taken; // = ((end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec)) / 1e9;
+   // Add up every thread's count; 64-bit integers so nothing overflows or rounds, however many samples we take
+   uint64_t in_circle = 0;
 
-   // Error occurs if the end_time.tv_nsec is less than start_time.tv_nsec due to wraparound errors; if statement checks if that's the case
-   if (time_end.tv_nsec < time_start.tv_nsec) 
-   {
-      time_taken = ((time_end.tv_sec - time_start.tv_sec - 1) + (time_end.tv_nsec + 1e9 - time_start.tv_nsec)) / 1e9;
-   } 
-    
-   else 
+   for (int t = 0; t < NUM_THREADS; t++)
    {
-      time_taken = ((time_end.tv_sec - time_start.tv_sec) + (time_end.tv_nsec - time_start.tv_nsec)) / 1e9;
+      in_circle += states[t].in_count;
    }
 
+   double gather_end = breakdown_now ();
+   memstats_phase ("CMonteCarloMemory.txt", "compute");
+
+   // Calculate time taken
+   double time_taken = prior_elapsed + elapsed_seconds (time_start, time_end);
+
+   // Final checkpoint shows the run as complete, so resuming it again just reports the result
+   if (checkpoint_path)
+      write_checkpoint (checkpoint_path, time_taken);
+
+   if (show_progress)
+      printf ("pi ~ %.10f from %llu samples in %f s\n", 4.0 * in_circle / TOT_COUNT, (unsigned long long) TOT_COUNT, time_taken);
+
    // Print timer results to output file
-   fprintf (output, "%lf\n", time_taken );
+   // run/resume output format is samples,threads,time,pi estimate
+   if (show_progress)
+      fprintf (output, "%llu,%d,%lf,%.10f\n", (unsigned long long) TOT_COUNT, NUM_THREADS, time_taken, 4.0 * in_circle / TOT_COUNT);
+
+   else
+      fprintf (output, "%lf\n", time_taken );
 
    // Close time file
    fclose (output);
+
+   // Overhead breakdown; distribute is thread start-up latency (each thread's seed and sample count are handed over in states[], nothing is copied)
+   // and gather is from the last thread finishing to the counts being summed. Skipped for run/resume, where the progress loop adds its own delay
+   if (!show_progress)
+   {
+      double started[NUM_THREADS], finished[NUM_THREADS];
+      double distribute = 0, last_finish = 0;
+      double compute_min, compute_avg, compute_max;
+
+      for (int t = 0; t < NUM_THREADS; t++)
+      {
+         started[t] = states[t].compute_start;
+         finished[t] = states[t].compute_end;
+         distribute += (started[t] - states[t].spawned_at) / NUM_THREADS;
+
+         if (finished[t] > last_finish)
+            last_finish = finished[t];
+      }
+
+      double teardown_begin = breakdown_now ();
+      free (states);
+      states = NULL;
+      double teardown_end = breakdown_now ();
+
+      breakdown_compute_stats (started, finished, NUM_THREADS, &compute_min, &compute_avg, &compute_max);
+      breakdown_write ("CMonteCarloBreakdown.txt", NUM_THREADS, spawn_end - spawn_begin, distribute, compute_min, compute_avg, compute_max,
+                       gather_end - last_finish, teardown_end - teardown_begin, teardown_end - spawn_begin);
+   }
+
+   return 0;
+}
+
+// Function to send one protocol message; returns 0 on success, -1 if the other side is gone
+int send_message (int fd, uint32_t type, uint32_t lease_id, uint64_t a, uint64_t b, uint64_t c)
+{
+   mcMessage msg;
+   msg.type = htobe32 (type);
+   msg.lease_id = htobe32 (lease_id);
+   msg.a = htobe64 (a);
+   msg.b = htobe64 (b);
+   msg.c = htobe64 (c);
+
+   size_t sent = 0;
+   while (sent < sizeof (msg))
+   {
+      ssize_t n = send (fd, (char*) &msg + sent, sizeof (msg) - sent, 0);
+
+      if (n < 0 && errno == EINTR)
+         continue;
+
+      if (n <= 0)
+         return -1;
+
+      sent += n;
+   }
+
+   return 0;
+}
+
+// Function to receive one protocol message; returns 0 on success, -1 on EOF or error
+int recv_message (int fd, mcMessage* msg)
+{
+   size_t got = 0;
+   while (got < sizeof (*msg))
+   {
+      ssize_t n = recv (fd, (char*) msg + got, sizeof (*msg) - got, 0);
+
+      if (n < 0 && errno == EINTR)
+         continue;
+
+      if (n <= 0)
+         return -1;
+
+      got += n;
+   }
+
+   msg->type = be32toh (msg->type);
+   msg->lease_id = be32toh (msg->lease_id);
+   msg->a = be64toh (msg->a);
+   msg->b = be64toh (msg->b);
+   msg->c = be64toh (msg->c);
+
+   return 0;
+}
+
+// Function to receive on a non-blocking worker socket without ever waiting for the rest of a message
+// Returns 1 with msg filled in once a whole message has arrived, 0 if more bytes are still to come, -1 on EOF or error
+int recv_partial (int fd, mcConn* conn, mcMessage* msg)
+{
+   while (conn->rx_len < sizeof (*msg))
+   {
+      ssize_t n = recv (fd, conn->rx + conn->rx_len, sizeof (*msg) - conn->rx_len, 0);
+
+      if (n < 0 && errno == EINTR)
+         continue;
+
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+         return 0;
+
+      if (n <= 0)
+         return -1;
+
+      conn->rx_len += n;
+   }
+
+   memcpy (msg, conn->rx, sizeof (*msg));
+   conn->rx_len = 0;
+
+   msg->type = be32toh (msg->type);
+   msg->lease_id = be32toh (msg->lease_id);
+   msg->a = be64toh (msg->a);
+   msg->b = be64toh (msg->b);
+   msg->c = be64toh (msg->c);
+
+   return 1;
+}
+
+// Function to open a socket from an address string; "unix:/path" or "tcp:host:port" ("tcp:port" is allowed when listening)
+// Listening sockets are bound and put into listen mode, otherwise the socket is connected; returns the fd or -1 on error
+int open_socket (const char* address, int listening)
+{
+   if (strncmp (address, "unix:", 5) == 0)
+   {
+      struct sockaddr_un addr;
+      memset (&addr, 0, sizeof (addr));
+      addr.sun_family = AF_UNIX;
+      strncpy (addr.sun_path, address + 5, sizeof (addr.sun_path) - 1);
+
+      int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+
+      if (fd < 0)
+      {
+         perror ("socket");
+         return -1;
+      }
+
+      if (listening)
+      {
+         // Clear out a socket file left behind by an earlier run
+         unlink (addr.sun_path);
+
+         if (bind (fd, (struct sockaddr*) &addr, sizeof (addr)) != 0 || listen (fd, MAX_WORKERS) != 0)
+         {
+            perror (address);
+            close (fd);
+            return -1;
+         }
+      }
+
+      else if (connect (fd, (struct sockaddr*) &addr, sizeof (addr)) != 0)
+      {
+         perror (address);
+         close (fd);
+         return -1;
+      }
+
+      return fd;
+   }
+
+   if (strncmp (address, "tcp:", 4) == 0)
+   {
+      // Split "host:port"; with no host a listener binds to every interface
+      char host[256] = "";
+      const char* port = strrchr (address + 4, ':');
+
+      if (port)
+      {
+         snprintf (host, sizeof (host), "%.*s", (int) (port - (address + 4)), address + 4);
+         port++;
+      }
+
+      else
+         port = address + 4;
+
+      struct addrinfo hints, *res;
+      memset (&hints, 0, sizeof (hints));
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      hints.ai_flags = listening ? AI_PASSIVE : 0;
+
+      int err = getaddrinfo (host[0] ? host : NULL, port, &hints, &res);
+
+      if (err)
+      {
+         fprintf (stderr, "%s: %s\n", address, gai_strerror (err));
+         return -1;
+      }
+
+      int fd = socket (res->ai_family, res->ai_socktype, res->ai_protocol);
+      int ok = (fd >= 0);
+
+      if (ok && listening)
+      {
+         int one = 1;
+         setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+         ok = (bind (fd, res->ai_addr, res->ai_addrlen) == 0 && listen (fd, MAX_WORKERS) == 0);
+      }
+
+      else if (ok)
+         ok = (connect (fd, res->ai_addr, res->ai_addrlen) == 0);
+
+      freeaddrinfo (res);
+
+      if (!ok)
+      {
+         perror (address);
+         if (fd >= 0)
+            close (fd);
+         return -1;
+      }
+
+      return fd;
+   }
+
+   fprintf (stderr, "Unknown address (expected unix:path or tcp:host:port): %s\n", address);
+   return -1;
+}
+
+// Worker mode: connect to the coordinator and keep pulling leases until told we're done
+// Progress is streamed back every PROGRESS_CHUNK samples so the coordinator can show a live estimate and notice if we stall
+int run_worker (const char* address)
+{
+   int fd = open_socket (address, 0);
+
+   if (fd < 0)
+      return EXIT_FAILURE;
+
+   mcMessage msg;
+   struct pollfd pfd = {fd, POLLIN, 0};
+   int awaiting_reply = 0;
+
+   // Set whenever hanging up now would be a normal finish: after a COMPLETE (or a cancelled lease), or once DONE has been seen
+   int clean_exit = 0;
+
+   while (1)
+   {
+      // The coordinator sends DONE as soon as the last lease finishes, which may already be waiting after our COMPLETE; read it before asking
+      // for more work, otherwise the REQUEST can hit a socket the coordinator has already finished with
+      if (!awaiting_reply && poll (&pfd, 1, 0) <= 0)
+      {
+         if (send_message (fd, MSG_REQUEST, 0, 0, 0, 0) != 0)
+            break;
+
+         awaiting_reply = 1;
+      }
+
+      if (recv_message (fd, &msg) != 0)
+         break;
+
+      // A CANCEL for a lease we've already finished crossed with our COMPLETE; the reply to our REQUEST (if any) is still on its way
+      if (msg.type == MSG_CANCEL)
+         continue;
+
+      awaiting_reply = 0;
+
+      if (msg.type == MSG_DONE)
+      {
+         close (fd);
+         return EXIT_SUCCESS;
+      }
+
+      if (msg.type == MSG_WAIT)
+      {
+         usleep (100000);
+         continue;
+      }
+
+      if (msg.type != MSG_LEASE)
+         break;
+
+      uint64_t done = 0;
+      uint64_t in_count = 0;
+      int seed = (int) msg.c;
+      int cancelled = 0;
+
+      clean_exit = 0;
+
+      // The coordinator only speaks unprompted to say DONE (the run is over) or CANCEL (another copy of this lease finished first),
+      // so check for those between chunks
+      while (done < msg.b)
+      {
+         if (poll (&pfd, 1, 0) > 0)
+         {
+            mcMessage early;
+
+            if (recv_message (fd, &early) != 0)
+               break;
+
+            if (early.type == MSG_DONE)
+            {
+               close (fd);
+               return EXIT_SUCCESS;
+            }
+
+            if (early.type == MSG_CANCEL && early.lease_id == msg.lease_id)
+            {
+               cancelled = 1;
+               break;
+            }
+
+            // Anything else is a stale CANCEL for an earlier lease
+            continue;
+         }
+
+         uint64_t chunk = (msg.b - done < PROGRESS_CHUNK) ? msg.b - done : PROGRESS_CHUNK;
+
+         in_count += sample_in_circle (chunk, &seed);
+         done += chunk;
+
+         if (done < msg.b && send_message (fd, MSG_PROGRESS, msg.lease_id, done, in_count, 0) != 0)
+            break;
+      }
+
+      if (cancelled)
+      {
+         clean_exit = 1;
+         continue;
+      }
+
+      if (done < msg.b || send_message (fd, MSG_COMPLETE, msg.lease_id, done, in_count, 0) != 0)
+         break;
+
+      clean_exit = 1;
+   }
+
+   // The connection broke; that's a normal finish if the coordinator's DONE is sitting in the socket (e.g. we were stopped for a while and the
+   // coordinator finished and hung up meanwhile), or if it hung up between leases, after our last COMPLETE
+   while (poll (&pfd, 1, 0) > 0 && recv_message (fd, &msg) == 0)
+   {
+      if (msg.type == MSG_DONE)
+         clean_exit = 1;
+   }
+
+   close (fd);
+
+   if (clean_exit)
+      return EXIT_SUCCESS;
+
+   // Coordinator went away before we finished anything, or in the middle of a lease, without saying the run was over
+   fprintf (stderr, "Lost connection to coordinator\n");
+   return EXIT_FAILURE;
+}
+
+// Function to give a worker its next lease: a pending lease if there is one, otherwise a backup copy of the lease that's been running the longest
+// Returns the lease index or -1 if there's nothing useful for this worker to do
+int pick_lease (mcLease* leases, int num_leases, int worker_id)
+{
+   int straggler = -1;
+
+   for (int l = 0; l < num_leases; l++)
+   {
+      if (leases[l].state == LEASE_PENDING)
+         return l;
+
+      // Only one backup per lease, and never back up a lease with the worker that already has it
+      if (leases[l].state == LEASE_ACTIVE && leases[l].backup < 0 && leases[l].owner != worker_id
+          && (straggler < 0 || leases[l].last_progress < leases[straggler].last_progress))
+         straggler = l;
+   }
+
+   return straggler;
+}
+
+// Function to drop a worker from every lease it holds; leases left with nobody working on them go back to pending
+// Returns how many leases went back to pending
+int release_worker (mcLease* leases, int num_leases, int worker_id)
+{
+   int released = 0;
+
+   for (int l = 0; l < num_leases; l++)
+   {
+      if (leases[l].state != LEASE_ACTIVE)
+         continue;
+
+      if (leases[l].backup == worker_id)
+         leases[l].backup = -1;
+
+      if (leases[l].owner == worker_id)
+      {
+         // Promote the backup (if any) so progress keeps being tracked, and throw away the old owner's partial counts
+         leases[l].owner = leases[l].backup;
+         leases[l].backup = -1;
+         leases[l].partial_samples = 0;
+         leases[l].partial_in = 0;
+         leases[l].last_progress = time (NULL);
+      }
+
+      if (leases[l].owner < 0)
+      {
+         leases[l].state = LEASE_PENDING;
+         released++;
+      }
+   }
+
+   return released;
+}
+
+// Coordinator mode: split total samples into leases, hand them out to whoever connects, and collect the counts
+// Works the same over a Unix socket (several workers on one host) or TCP (workers on several hosts)
+int run_coordinator (const char* address, uint64_t total, uint64_t lease_size)
+{
+   int listen_fd = open_socket (address, 1);
+
+   if (listen_fd < 0)
+      return EXIT_FAILURE;
+
+   // Worked out without total + lease_size - 1, which can wrap for totals near 2^64
+   uint64_t lease_count = total / lease_size + (total % lease_size != 0);
+
+   if (lease_count > INT_MAX)
+   {
+      fprintf (stderr, "Too many leases (%llu); use a bigger lease size\n", (unsigned long long) lease_count);
+      close (listen_fd);
+      return EXIT_FAILURE;
+   }
+
+   int num_leases = (int) lease_count;
+   mcLease* leases = calloc (num_leases, sizeof (mcLease));
+
+   if (!leases)
+   {
+      fprintf (stderr, "Memory allocation failed\n");
+      exit (EXIT_FAILURE);
+   }
+
+   // Seed each lease off the run's base seed and its index, same idea as the time ^ tid seeds in monteCarloPi
+   uint32_t base_seed = (uint32_t) time (NULL);
+
+   for (int l = 0; l < num_leases; l++)
+   {
+      leases[l].state = LEASE_PENDING;
+      leases[l].start = (uint64_t) l * lease_size;
+      leases[l].count = (leases[l].start + lease_size <= total) ? lease_size : total - leases[l].start;
+      leases[l].seed = base_seed ^ ((uint32_t) l * 2654435761u);
+      leases[l].owner = -1;
+      leases[l].backup = -1;
+   }
+
+   // pollfds[0] is the listening socket; pollfds[w + 1] goes with conns[w]
+   // Worker ids only ever count up, so a reused fd number can never be mistaken for the worker that had it before
+   struct pollfd pollfds[MAX_WORKERS + 1];
+   mcConn conns[MAX_WORKERS];
+   int num_workers = 0;
+   int next_worker_id = 0;
+   int leases_done = 0;
+   int releases = 0;
+
+   pollfds[0].fd = listen_fd;
+   pollfds[0].events = POLLIN;
+
+   struct timespec time_start, time_now, last_report;
+   clock_gettime (CLOCK_MONOTONIC, &time_start);
+   last_report = time_start;
+
+   // Keep going until every lease is done
+   while (leases_done < num_leases)
+   {
+      poll (pollfds, num_workers + 1, 200);
+
+      // New worker connecting; with the table full it's accepted and hung up on straight away, otherwise it would sit in the
+      // backlog and keep the listening socket readable on every poll
+      if (pollfds[0].revents & POLLIN)
+      {
+         int fd = accept (listen_fd, NULL, NULL);
+
+         if (fd >= 0 && num_workers == MAX_WORKERS)
+            close (fd);
+
+         else if (fd >= 0)
+         {
+            // Non-blocking, so a worker that stops halfway through a message can't hold up everyone else
+            fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+
+            pollfds[num_workers + 1].fd = fd;
+            pollfds[num_workers + 1].events = POLLIN;
+            pollfds[num_workers + 1].revents = 0;
+            conns[num_workers].id = next_worker_id++;
+            conns[num_workers].rx_len = 0;
+            num_workers++;
+         }
+      }
+
+      for (int w = 0; w < num_workers; w++)
+      {
+         if (!pollfds[w + 1].revents)
+            continue;
+
+         int fd = pollfds[w + 1].fd;
+         int id = conns[w].id;
+         mcMessage msg;
+         int drop = 0;
+
+         // Handle every whole message that's arrived; a partial one stays in the buffer until the rest shows up
+         while (!drop)
+         {
+            int got = recv_partial (fd, &conns[w], &msg);
+
+            if (got == 0)
+               break;
+
+            if (got < 0)
+               drop = 1;
+
+            else if (msg.type == MSG_REQUEST && leases_done < num_leases)
+            {
+               int l = pick_lease (leases, num_leases, id);
+
+               if (l < 0)
+                  drop = send_message (fd, MSG_WAIT, 0, 0, 0, 0) != 0;
+
+               else
+               {
+                  if (leases[l].state == LEASE_PENDING)
+                  {
+                     leases[l].state = LEASE_ACTIVE;
+                     leases[l].owner = id;
+                     leases[l].partial_samples = 0;
+                     leases[l].partial_in = 0;
+                     leases[l].last_progress = time (NULL);
+                  }
+
+                  else
+                     leases[l].backup = id;
+
+                  drop = send_message (fd, MSG_LEASE, l, leases[l].start, leases[l].count, leases[l].seed) != 0;
+               }
+            }
+
+            // Partial counts are only kept from the lease's current owner; anything else is a stale or backup copy
+            else if (msg.type == MSG_PROGRESS && msg.lease_id < (uint32_t) num_leases)
+            {
+               mcLease* lease = &leases[msg.lease_id];
+
+               if (lease->state == LEASE_ACTIVE && lease->owner == id)
+               {
+                  lease->partial_samples = msg.a;
+                  lease->partial_in = msg.b;
+                  lease->last_progress = time (NULL);
+               }
+            }
+
+            // A COMPLETE that doesn't cover the whole lease can't come from a working copy, so the sender is treated like a crashed worker
+            else if (msg.type == MSG_COMPLETE && (msg.lease_id >= (uint32_t) num_leases || msg.a != leases[msg.lease_id].count))
+               drop = 1;
+
+            // First COMPLETE for a lease wins, whoever sent it; any copy of a lease gives the same count
+            // Whoever else is still running it gets a CANCEL so it can move on to something useful
+            else if (msg.type == MSG_COMPLETE && leases[msg.lease_id].state != LEASE_DONE)
+            {
+               mcLease* lease = &leases[msg.lease_id];
+
+               lease->state = LEASE_DONE;
+               lease->in_count = msg.b;
+               leases_done++;
+
+               for (int o = 0; o < num_workers; o++)
+               {
+                  if (conns[o].id != id && (conns[o].id == lease->owner || conns[o].id == lease->backup))
+                     send_message (pollfds[o + 1].fd, MSG_CANCEL, msg.lease_id, 0, 0, 0);
+               }
+
+               lease->owner = -1;
+               lease->backup = -1;
+            }
+         }
+
+         // Worker hung up (or sent garbage); re-lease whatever it had and remove it from the poll set
+         if (drop)
+         {
+            releases += release_worker (leases, num_leases, id);
+            close (fd);
+
+            pollfds[w + 1] = pollfds[num_workers];
+            conns[w] = conns[num_workers - 1];
+            num_workers--;
+            w--;
+         }
+      }
+
+      // Leases whose owner hasn't reported in for LEASE_TIMEOUT_SEC go back to pending; if the slow worker finishes after all, its COMPLETE still counts
+      time_t now = time (NULL);
+
+      for (int l = 0; l < num_leases; l++)
+      {
+         if (leases[l].state != LEASE_ACTIVE || now - leases[l].last_progress <= LEASE_TIMEOUT_SEC)
+            continue;
+
+         // Nobody left reporting for it (the owner's copy was dropped and there was no backup to promote); just put it back
+         if (leases[l].owner < 0)
+         {
+            leases[l].state = LEASE_PENDING;
+            leases[l].backup = -1;
+            releases++;
+         }
+
+         else
+            releases += release_worker (leases, num_leases, leases[l].owner);
+      }
+
+      // Live estimate once a second: finished leases plus whatever the active owners have streamed back so far
+      clock_gettime (CLOCK_MONOTONIC, &time_now);
+
+      if (time_now.tv_sec > last_report.tv_sec)
+      {
+         uint64_t samples = 0, in_circle = 0;
+
+         for (int l = 0; l < num_leases; l++)
+         {
+            samples += (leases[l].state == LEASE_DONE) ? leases[l].count : leases[l].partial_samples;
+            in_circle += (leases[l].state == LEASE_DONE) ? leases[l].in_count : leases[l].partial_in;
+         }
+
+         if (samples > 0)
+            printf ("%d/%d leases, %d workers, %llu samples, pi ~ %.8f\n", leases_done, num_leases, num_workers,
+                    (unsigned long long) samples, 4.0 * in_circle / samples);
+         fflush (stdout);
+
+         last_report = time_now;
+      }
+   }
+
+   clock_gettime (CLOCK_MONOTONIC, &time_now);
+
+   // Tell everyone still connected to exit, including any worker still running a duplicate copy of the last lease, and hang up
+   // A REQUEST sitting unanswered in the socket doesn't matter, the worker just reads DONE as its reply, and a worker that is stopped
+   // or slow to read still finds the DONE queued ahead of the EOF whenever it gets to it; nothing here waits on any of them
+   // Whatever they already sent is read off first, since closing with unread data makes the kernel reset the connection instead
+   for (int w = 0; w < num_workers; w++)
+   {
+      char discard[256];
+
+      send_message (pollfds[w + 1].fd, MSG_DONE, 0, 0, 0, 0);
+
+      while (recv (pollfds[w + 1].fd, discard, sizeof (discard), 0) > 0);
+
+      close (pollfds[w + 1].fd);
+   }
+
+   uint64_t in_circle = 0;
+
+   for (int l = 0; l < num_leases; l++)
+      in_circle += leases[l].in_count;
+
+   double time_taken = (time_now.tv_sec - time_start.tv_sec) + (time_now.tv_nsec - time_start.tv_nsec) / 1e9;
+   double pi_estimate = 4.0 * in_circle / total;
+
+   printf ("pi ~ %.10f from %llu samples in %f s (%d workers used, %d leases re-issued)\n", pi_estimate,
+           (unsigned long long) total, time_taken, next_worker_id, releases);
+
+   // Output format is total samples,workers,time,pi estimate
+   FILE* output = fopen ("CMonteCarloDistributedResults.txt", "a");
+
+   if (!output)
+   {
+      printf ("Error opening file");
+      exit (-1);
+   }
+
+   fprintf (output, "%llu,%d,%lf,%.10f\n", (unsigned long long) total, next_worker_id, time_taken, pi_estimate);
+   fclose (output);
+
+   close (listen_fd);
+
+   if (strncmp (address, "unix:", 5) == 0)
+      unlink (address + 5);
+
+   free (leases);
+
+   return EXIT_SUCCESS;
+}
+
+int main (int argc, char *argv[])
+{
+   // Initialize variables; number of cores in computer
+   // Thread count from Assignment 5 EC
+   NUM_THREADS = sysconf (_SC_NPROCESSORS_ONLN);
+
+   // Memory instrumentation (only with -DMEMSTATS); one line per phase in CMonteCarloMemory.txt, for the default and run/resume modes
+   memstats_begin ();
+
+   const char* checkpoint_path = NULL;
+   int checkpoint_interval = 60;
+   double prior_elapsed = 0;
+   int show_progress = 0;
+
+   // Optional modes; with no arguments we run the original single-machine benchmark below
+   if (argc > 1 && strcmp (argv[1], "run") == 0 && argc >= 3 && strtoull (argv[2], NULL, 10) > 0)
+   {
+      TOT_COUNT = strtoull (argv[2], NULL, 10);
+      checkpoint_path = (argc > 3) ? argv[3] : NULL;
+      checkpoint_interval = (argc > 4 && atoi (argv[4]) > 0) ? atoi (argv[4]) : checkpoint_interval;
+      show_progress = 1;
+   }
+
+   else if (argc > 1 && strcmp (argv[1], "resume") == 0 && argc >= 3)
+   {
+      checkpoint_path = argv[2];
+      checkpoint_interval = (argc > 3 && atoi (argv[3]) > 0) ? atoi (argv[3]) : checkpoint_interval;
+      show_progress = 1;
+
+      // Thread count comes from the checkpoint, not this machine, since every thread has its own RNG stream to continue
+      prior_elapsed = read_checkpoint (checkpoint_path);
+
+      if (prior_elapsed < 0)
+         return EXIT_FAILURE;
+
+      // A checkpoint from a run that already finished just gets its result reported; starting the threads again would only add
+      // a progress-poll interval to the time and write the same checkpoint back
+      uint64_t in_circle = 0;
+      int complete = 1;
+
+      for (int t = 0; t < NUM_THREADS; t++)
+      {
+         in_circle += states[t].in_count;
+
+         if (states[t].done != states[t].target)
+            complete = 0;
+      }
+
+      if (complete)
+      {
+         printf ("pi ~ %.10f from %llu samples in %f s (checkpoint was already complete)\n", 4.0 * in_circle / TOT_COUNT,
+                 (unsigned long long) TOT_COUNT, prior_elapsed);
+         free (states);
+
+         return 0;
+      }
+   }
+
+   else if (argc > 1)
+   {
+      // A worker or coordinator vanishing mid-send should show up as a send error, not kill the process
+      signal (SIGPIPE, SIG_IGN);
+
+      if (strcmp (argv[1], "worker") == 0 && argc >= 3)
+         return run_worker (argv[2]);
+
+      if (strcmp (argv[1], "coordinator") == 0 && argc >= 5 && strtoull (argv[3], NULL, 10) > 0 && strtoull (argv[4], NULL, 10) > 0)
+         return run_coordinator (argv[2], strtoull (argv[3], NULL, 10), strtoull (argv[4], NULL, 10));
+
+      fprintf (stderr, "Usage:\n %s %s\n", argv[0], USAGE);
+      return EXIT_FAILURE;
+   }
+
+   // Fresh run: divide the samples between threads, with the remainder going to the first thread
+   if (!states)
+   {
+      states = calloc (NUM_THREADS, sizeof (threadState));
+
+      if (!states)
+      {
+         fprintf (stderr, "Memory allocation failed\n");
+         exit (EXIT_FAILURE);
+      }
+
+      for (int t = 0; t < NUM_THREADS; t++)
+      {
+         states[t].target = TOT_COUNT / NUM_THREADS + ((t == 0) ? TOT_COUNT % NUM_THREADS : 0);
+
+         // Generate thread-unique seed for true random numbers, suggested example used clock value to the power of threadID mulitplied by a large number
+         states[t].seed = (int)(time (NULL) ^ (t * 50));
+      }
+   }
+
+   // Ctrl-C during a long run writes a checkpoint instead of throwing the work away
+   if (show_progress)
+   {
+      signal (SIGINT, request_stop);
+      signal (SIGTERM, request_stop);
+   }
+
+   memstats_phase ("CMonteCarloMemory.txt", "setup");
+
+   int stopped = run_estimate (checkpoint_path, checkpoint_interval, prior_elapsed, show_progress);
+
+   if (!stopped)
+      free (states);
+
+   memstats_phase ("CMonteCarloMemory.txt", stopped ? "stopped" : "teardown");
    
    // Exit main
-   return 0;
-}
\ No newline at end of file
+   return stopped ? EXIT_FAILURE : 0;
+}
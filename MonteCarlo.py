@@ -15,6 +15,9 @@ import time
 import math
 import os
 
+import breakdown
+import memstats
+
  # We want to figure out the max number of processes we can run based on CPU cores, which we can do with cpu_count ()
  # TOT_COUNT is the variable we change to vary the difficulty of the program. 10 million, 50 million, and 100 million are the testing sizes
 NUM_PROCESSES = os.cpu_count ()
@@ -53,11 +56,25 @@ def monteCarloPi (processID):
     # Return locally calculated value
     return local_count
 
+
+# Same as monteCarloPi, but also returns which process ran it and when it started/finished, for the overhead breakdown
+def timedMonteCarloPi (processID):
+    compute_start = time.monotonic_ns ()
+    local_count = monteCarloPi (processID)
+    compute_end = time.monotonic_ns ()
+
+    return (os.getpid (), compute_start, compute_end, local_count)
+
 if __name__ == '__main__':
 
     # Create timer variable and start clock
     # Inspiration taken from CSCI 440 Github repo timing.py
+    # Memory instrumentation (only with MEMSTATS=1); one line per phase in PyMonteCarloMemory.txt
+    # There's nothing to set up before the pool here, so the phases are just the pool's lifetime and summing the counts
+    memstats.begin ()
+
     start_time = time.time_ns ()
+    spawn_begin = time.monotonic_ns ()
 
     # Python uses the multiprocessing library instead of threads
     # Research seems to recommend multiprocessing.pool as it is useful for returning values from the called function
@@ -65,19 +82,31 @@ if __name__ == '__main__':
     # Range will act as a loop counter/processs ID, iterating by one every loop
     # Map is used as it's designed to do work and return a value
     with multiprocessing.Pool (processes = NUM_PROCESSES) as pool:
-        value = pool.map (monteCarloPi, range (NUM_PROCESSES))
+        spawn_end = time.monotonic_ns ()
+        timed_values = pool.map (timedMonteCarloPi, range (NUM_PROCESSES))
+        map_end = time.monotonic_ns ()
+
+    teardown_end = time.monotonic_ns ()
+    memstats.phase ("PyMonteCarloMemory.txt", "compute")
 
     # The sum of all returned values is assigned to the in_circle variable
-    in_circle = sum (value)
+    in_circle = sum (count for _, _, _, count in timed_values)
     
     # Pi is calculated
     pi_estimate = 4 * (in_circle / TOT_COUNT)
 
     # Stop timer, calculate time taken
     end_time = time.time_ns ()
-    time_taken = (end_time - start_time) / (1e9)
-
-    # Define and open output file to store results in
-    with open ("PyMonteCarloResults.txt", "a") as output:
-        output.write (f"{time_taken:.6f}\n")#
+    gather_end = time.monotonic_ns ()
+    memstats.phase ("PyMonteCarloMemory.txt", "gather")
+
+    # Overhead breakdown, same phases as PyMatrixMultBreakdown.txt; only the process ID goes out and one int comes back, so distribute/gather are nearly all pool messaging
+    # Timing files are skipped when memory instrumentation is on, since tracemalloc and the phase bookkeeping inflate the times
+    if not memstats.ENABLED:
+        breakdown.write_breakdown ("PyMonteCarloBreakdown.txt", timed_values, spawn_begin, spawn_end, spawn_end, map_end, teardown_end, gather_end)
+        time_taken = (end_time - start_time) / (1e9)
+
+        # Define and open output file to store results in
+        with open ("PyMonteCarloResults.txt", "a") as output:
+            output.write (f"{time_taken:.6f}\n")#
 
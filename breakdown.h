@@ -0,0 +1,76 @@
+/*
+Montana Pawek
+
+Overhead breakdown shared by the C workloads
+Every program times one big interval for its results file; this splits the same run into phases so the C and Python versions
+can be compared phase by phase instead of only end to end. The Python versions write the same columns in the same order.
+
+Phases (all in seconds):
+    spawn       creating the worker threads/processes
+    distribute  getting each worker its work; for threads this is mostly thread start-up latency since the data is shared
+    compute     time each worker spends on the actual work; reported as min, average and max across workers
+    gather      collecting the workers' results once the last one is done (joins, summing, rebuilding the result)
+    teardown    cleanup after the results are in (freeing memory, shutting down pools)
+    total       first spawn to end of teardown
+
+Phases can overlap (early workers start computing while later ones are still being spawned), so they don't have to add up to total.
+Header-only so each program still compiles on its own with gcc -pthread <file>.c
+*/
+
+#ifndef BREAKDOWN_H
+#define BREAKDOWN_H
+
+#include <stdio.h>
+#include <time.h>
+
+// Function to get the current CLOCK_MONOTONIC time in seconds
+static inline double breakdown_now (void)
+{
+    struct timespec t;
+    clock_gettime (CLOCK_MONOTONIC, &t);
+
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Function to get the min, average and max of per-worker compute times (end[i] - start[i])
+static inline void breakdown_compute_stats (const double* start, const double* end, int workers, double* min, double* avg, double* max)
+{
+    double total = 0;
+
+    *min = 0;
+    *max = 0;
+
+    for (int i = 0; i < workers; i++)
+    {
+        double t = end[i] - start[i];
+
+        if (i == 0 || t < *min)
+            *min = t;
+
+        if (i == 0 || t > *max)
+            *max = t;
+
+        total += t;
+    }
+
+    *avg = (workers > 0) ? total / workers : 0;
+}
+
+// Function to append one breakdown line to a results file
+// Output format is workers,spawn,distribute,compute min,compute avg,compute max,gather,teardown,total
+static inline void breakdown_write (const char* path, int workers, double spawn, double distribute, double compute_min,
+                                    double compute_avg, double compute_max, double gather, double teardown, double total)
+{
+    FILE* output = fopen (path, "a");
+
+    if (!output)
+    {
+        perror (path);
+        return;
+    }
+
+    fprintf (output, "%d,%f,%f,%f,%f,%f,%f,%f,%f\n", workers, spawn, distribute, compute_min, compute_avg, compute_max, gather, teardown, total);
+    fclose (output);
+}
+
+#endif
@@ -0,0 +1,38 @@
+# Montana Pawek
+# Overhead breakdown shared by the Python workloads; writes the same columns as breakdown.h does for the C versions:
+#     workers,spawn,distribute,compute min,compute avg,compute max,gather,teardown,total
+# All times are in seconds. Phases can overlap, so they don't have to add up to total.
+# Times are time.monotonic_ns values, which are system-wide on Linux, so start/end times recorded inside worker processes line up with the parent's
+
+NS = 1e9
+
+
+# Collapse per-task (pid, compute_start, compute_end, ...) tuples into per-worker compute time
+# A Pool can hand one process more than one task, so times are summed per process
+def worker_compute_times (timed_results):
+    per_worker = {}
+
+    for pid, compute_start, compute_end, *_ in timed_results:
+        per_worker[pid] = per_worker.get (pid, 0) + (compute_end - compute_start)
+
+    return [t / NS for t in per_worker.values ()]
+
+
+# Write one breakdown line for a Pool-based run
+# spawn_begin/spawn_end bracket creating the Pool, dispatch is when the tasks were handed to the Pool, map_end is when the map call returned,
+# teardown_end is when the with-block closed the Pool, and gather_end is when the parent finished putting the results together
+# distribute is the average time from dispatch to a task starting; gather is from the last task finishing to map returning, plus the parent's own work after teardown
+def write_breakdown (path, timed_results, spawn_begin, spawn_end, dispatch, map_end, teardown_end, gather_end):
+    compute = worker_compute_times (timed_results)
+    distribute = sum (compute_start - dispatch for _, compute_start, *_ in timed_results) / len (timed_results) / NS
+    last_finish = max (compute_end for _, _, compute_end, *_ in timed_results)
+    gather = ((map_end - last_finish) + (gather_end - teardown_end)) / NS
+
+    write_line (path, len (compute), (spawn_end - spawn_begin) / NS, distribute, min (compute), sum (compute) / len (compute), max (compute),
+                gather, (teardown_end - map_end) / NS, (gather_end - spawn_begin) / NS)
+
+
+# Append one breakdown line to a results file
+def write_line (path, workers, spawn, distribute, compute_min, compute_avg, compute_max, gather, teardown, total):
+    with open (path, "a") as output:
+        output.write (f"{workers},{spawn:.6f},{distribute:.6f},{compute_min:.6f},{compute_avg:.6f},{compute_max:.6f},{gather:.6f},{teardown:.6f},{total:.6f}\n")
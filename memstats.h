@@ -0,0 +1,210 @@
+/*
+Montana Pawek
+
+Opt-in memory instrumentation shared by the C workloads
+Build with -DMEMSTATS (gcc -pthread -DMEMSTATS MatrixMult.c -o MatrixMult) and each program appends one line per phase of its
+default run to a *Memory.txt file next to its timing results. Without -DMEMSTATS everything below compiles away to nothing.
+
+Columns: phase,allocs,alloc bytes,frees,peak heap bytes,peak RSS KB,minor faults,major faults
+    allocs/alloc bytes/frees    malloc/calloc/realloc/free calls made by the program itself during the phase
+    peak heap bytes             most bytes the program had malloc'd at once during the phase
+    peak RSS KB                 VmHWM, reset at the start of each phase where the kernel allows it (otherwise the peak since the process started)
+    minor/major faults          page faults during the phase, from getrusage
+
+Allocations are counted by defining malloc and friends as macros around the real ones, so it only sees calls in the file that includes this
+header, not ones inside libc (getaddrinfo's, for example). It has to be included after every system header for the same reason.
+Each block gets a small size header so free knows how many bytes went away; nothing that reaches our free may come from libc's malloc.
+*/
+
+#ifndef MEMSTATS_H
+#define MEMSTATS_H
+
+#ifdef MEMSTATS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/resource.h>
+
+// Size header in front of every block; padded to max_align_t so the pointer we hand back keeps malloc's alignment
+typedef union
+{
+    size_t size;
+    max_align_t align;
+
+} memstatsHeader;
+
+// Counters for the current phase; updated from every thread, so all changes go through the __atomic builtins
+static unsigned long memstats_allocs, memstats_frees;
+static size_t memstats_bytes, memstats_live, memstats_peak;
+
+// Fault counts at the start of the current phase
+static long memstats_minflt, memstats_majflt;
+
+// Function to add a block to the counters and bump the phase's peak heap if needed
+static inline void memstats_add (size_t size)
+{
+    __atomic_add_fetch (&memstats_allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&memstats_bytes, size, __ATOMIC_RELAXED);
+
+    size_t live = __atomic_add_fetch (&memstats_live, size, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n (&memstats_peak, __ATOMIC_RELAXED);
+
+    // Another thread may raise the peak between our load and store, so retry until ours is no longer bigger
+    while (live > peak && !__atomic_compare_exchange_n (&memstats_peak, &peak, live, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static inline void* memstats_malloc (size_t size)
+{
+    memstatsHeader* block = malloc (sizeof (memstatsHeader) + size);
+
+    if (!block)
+        return NULL;
+
+    block->size = size;
+    memstats_add (size);
+
+    return block + 1;
+}
+
+static inline void* memstats_calloc (size_t count, size_t size)
+{
+    // Same overflow check calloc does for us normally
+    if (size && count > (SIZE_MAX - sizeof (memstatsHeader)) / size)
+        return NULL;
+
+    void* ptr = memstats_malloc (count * size);
+
+    if (ptr)
+        memset (ptr, 0, count * size);
+
+    return ptr;
+}
+
+static inline void memstats_free (void* ptr)
+{
+    if (!ptr)
+        return;
+
+    memstatsHeader* block = (memstatsHeader*) ptr - 1;
+
+    __atomic_add_fetch (&memstats_frees, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch (&memstats_live, block->size, __ATOMIC_RELAXED);
+    free (block);
+}
+
+// realloc is counted as a free of the old block and an allocation of the new one
+static inline void* memstats_realloc (void* ptr, size_t size)
+{
+    if (!ptr)
+        return memstats_malloc (size);
+
+    memstatsHeader* old = (memstatsHeader*) ptr - 1;
+    size_t old_size = old->size;
+    memstatsHeader* block = realloc (old, sizeof (memstatsHeader) + size);
+
+    if (!block)
+        return NULL;
+
+    block->size = size;
+    __atomic_add_fetch (&memstats_frees, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch (&memstats_live, old_size, __ATOMIC_RELAXED);
+    memstats_add (size);
+
+    return block + 1;
+}
+
+// From here on, the including file's calls go through the wrappers above
+#define malloc(size) memstats_malloc (size)
+#define calloc(count, size) memstats_calloc (count, size)
+#define realloc(ptr, size) memstats_realloc (ptr, size)
+#define free(ptr) memstats_free (ptr)
+
+// Function to read the peak resident set size in KB from /proc; falls back to getrusage's lifetime peak
+static inline long memstats_peak_rss (void)
+{
+    FILE* status = fopen ("/proc/self/status", "r");
+    char line[256];
+    long kb = -1;
+
+    while (status && fgets (line, sizeof (line), status))
+    {
+        if (sscanf (line, "VmHWM: %ld", &kb) == 1)
+            break;
+    }
+
+    if (status)
+        fclose (status);
+
+    if (kb < 0)
+    {
+        struct rusage usage;
+        getrusage (RUSAGE_SELF, &usage);
+        kb = usage.ru_maxrss;
+    }
+
+    return kb;
+}
+
+// Function to start a new phase: zero the counters, remember the fault counts and reset the kernel's peak RSS
+// Writing 5 to clear_refs resets VmHWM to the current RSS; kernels that don't support it just keep the lifetime peak
+static inline void memstats_begin (void)
+{
+    struct rusage usage;
+    getrusage (RUSAGE_SELF, &usage);
+
+    memstats_minflt = usage.ru_minflt;
+    memstats_majflt = usage.ru_majflt;
+
+    __atomic_store_n (&memstats_allocs, 0, __ATOMIC_RELAXED);
+    __atomic_store_n (&memstats_frees, 0, __ATOMIC_RELAXED);
+    __atomic_store_n (&memstats_bytes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n (&memstats_peak, __atomic_load_n (&memstats_live, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+
+    FILE* clear_refs = fopen ("/proc/self/clear_refs", "w");
+
+    if (clear_refs)
+    {
+        fputs ("5", clear_refs);
+        fclose (clear_refs);
+    }
+}
+
+// Function to end the current phase: append its line to the results file and start the next phase
+static inline void memstats_phase (const char* path, const char* phase)
+{
+    struct rusage usage;
+    getrusage (RUSAGE_SELF, &usage);
+
+    long rss = memstats_peak_rss ();
+    FILE* output = fopen (path, "a");
+
+    if (!output)
+        perror (path);
+
+    else
+    {
+        fprintf (output, "%s,%lu,%zu,%lu,%zu,%ld,%ld,%ld\n", phase, __atomic_load_n (&memstats_allocs, __ATOMIC_RELAXED),
+                 __atomic_load_n (&memstats_bytes, __ATOMIC_RELAXED), __atomic_load_n (&memstats_frees, __ATOMIC_RELAXED),
+                 __atomic_load_n (&memstats_peak, __ATOMIC_RELAXED), rss, usage.ru_minflt - memstats_minflt, usage.ru_majflt - memstats_majflt);
+        fclose (output);
+    }
+
+    memstats_begin ();
+}
+
+#else
+
+// Instrumentation off; the calls in each program cost nothing
+static inline void memstats_begin (void) {}
+static inline void memstats_phase (const char* path, const char* phase)
+{
+    (void) path;
+    (void) phase;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,95 @@
+# Montana Pawek
+# Opt-in memory instrumentation shared by the Python workloads; the Python side of memstats.h
+# Run with MEMSTATS=1 in the environment (MEMSTATS=1 python3 MatrixMult.py) and each program appends one line per phase to a Py*Memory.txt file.
+# Without it every call here returns straight away; tracemalloc slows Python down a lot, so it's never on by default
+#
+# Columns: phase,net blocks,net bytes,peak heap bytes,peak RSS KB,minor faults,major faults
+#     net blocks/net bytes    change in the parent's live Python allocations over the phase (Python has no cumulative malloc count to read)
+#     peak heap bytes         tracemalloc's peak for the phase; forked workers inherit tracing, but only the parent's numbers are seen here
+#     peak RSS KB             the larger of the parent's VmHWM and the biggest worker process that has exited so far
+#     minor/major faults      page faults in the parent plus any worker processes that exited during the phase
+# Workers only show up in RSS/fault numbers once they've exited and been joined, which is why each program ends a phase after its pool closes
+# Timings from an instrumented run aren't comparable to normal ones, so the programs skip their timing/breakdown files while this is on
+
+import os
+import resource
+import sys
+import tracemalloc
+
+ENABLED = bool (os.environ.get ("MEMSTATS"))
+
+# Counts at the start of the current phase
+_start = {}
+
+
+# Workers (Pool processes, DNS resolvers, the Manager's server) are forked from the parent and would inherit tracemalloc, which slows every
+# allocation they make; only the parent's allocations are reported, so tracing is stopped in each child as soon as it's forked
+def _stop_in_child ():
+    if tracemalloc.is_tracing ():
+        tracemalloc.stop ()
+
+
+if ENABLED:
+    os.register_at_fork (after_in_child = _stop_in_child)
+
+
+# Fault counts for this process plus its finished children
+def _faults ():
+    own = resource.getrusage (resource.RUSAGE_SELF)
+    children = resource.getrusage (resource.RUSAGE_CHILDREN)
+
+    return own.ru_minflt + children.ru_minflt, own.ru_majflt + children.ru_majflt
+
+
+# Peak RSS in KB; VmHWM from /proc if we can read it, getrusage's lifetime peak if not
+def _peak_rss ():
+    own = resource.getrusage (resource.RUSAGE_SELF).ru_maxrss
+
+    try:
+        with open ("/proc/self/status") as status:
+            for line in status:
+                if line.startswith ("VmHWM:"):
+                    own = int (line.split ()[1])
+                    break
+
+    except OSError:
+        pass
+
+    return max (own, resource.getrusage (resource.RUSAGE_CHILDREN).ru_maxrss)
+
+
+# Start a new phase: remember the counts and reset the peaks (writing 5 to clear_refs resets VmHWM where the kernel supports it)
+def begin ():
+    if not ENABLED:
+        return
+
+    if not tracemalloc.is_tracing ():
+        tracemalloc.start ()
+
+    tracemalloc.reset_peak ()
+
+    _start["blocks"] = sys.getallocatedblocks ()
+    _start["bytes"] = tracemalloc.get_traced_memory ()[0]
+    _start["minflt"], _start["majflt"] = _faults ()
+
+    try:
+        with open ("/proc/self/clear_refs", "w") as clear_refs:
+            clear_refs.write ("5")
+
+    except OSError:
+        pass
+
+
+# End the current phase: append its line to the results file and start the next phase
+def phase (path, name):
+    if not ENABLED:
+        return
+
+    current, peak = tracemalloc.get_traced_memory ()
+    minflt, majflt = _faults ()
+
+    with open (path, "a") as output:
+        output.write (f"{name},{sys.getallocatedblocks () - _start['blocks']},{current - _start['bytes']},{peak},{_peak_rss ()},"
+                      f"{minflt - _start['minflt']},{majflt - _start['majflt']}\n")
+
+    begin ()
@@ -33,12 +33,87 @@ Resources used:
         valgrind
 */
 #include <pthread.h>
+#include <arpa/inet.h>
 
 #define MAX_NAME_LENGTH 1025
 #define MAX_INPUT_FILES 10
 #define MAX_RESOLVER_THREADS 10
 #define MIN_RESOLVER_THREADS 2
 
+// Every in-use in-flight slot always has at least one resolver attached to it (the one doing the lookup, or one still waiting to copy the answer),
+// so there can never be more slots in use than there are resolver threads
+#define MAX_INFLIGHT MAX_RESOLVER_THREADS
+
+// Most lookup attempt threads (first attempts and hedges, abandoned ones included) that may be running at once
+// getaddrinfo can't be cancelled, so while DNS is hanging every deadline or hedge would otherwise leave one more thread behind
+#define MAX_ATTEMPTS (4 * MAX_RESOLVER_THREADS)
+
+// Answers waiting to be written to one daemon client; a socket client that falls this far behind is dropped instead of blocking the resolvers
+#define CLIENT_BACKLOG 4096
+
+// One hostname that's currently being looked up; other resolvers that pull the same name wait on this instead of calling dnslookup again
+struct inflight_lookup
+{
+    int in_use;                                              // Slot is taken
+    int done;                                                // Lookup finished and ip is filled in
+    int waiters;                                             // Resolvers still waiting to copy ip out; slot is freed when this hits 0 after done
+    char name[MAX_NAME_LENGTH];                              // Hostname being looked up
+    char ip[INET6_ADDRSTRLEN];                               // Result; empty string if the lookup failed
+    pthread_cond_t resolved;                                 // Broadcast when done is set
+};
+
+// Latency histogram used for hedging decisions and the end-of-run percentiles
+// Buckets are log-spaced, LATENCY_BUCKETS_PER_DOUBLING per power of two starting at 1 microsecond, which covers up to ~30 seconds at ~9% resolution
+// A histogram (rather than a list of every sample) keeps recording O(1) and percentile lookups cheap enough to do on every lookup
+#define LATENCY_BUCKETS 200
+#define LATENCY_BUCKETS_PER_DOUBLING 8
+
+struct latency_histogram
+{
+    long counts[LATENCY_BUCKETS];
+    long total;
+};
+
+// Lookup deadline/hedging settings and statistics
+// This one lives in a global instead of shared_variables: an abandoned lookup attempt can still be running (and recording its latency)
+// after main has returned, so it can't point at anything on main's stack
+struct lookup_stats
+{
+    int deadline_ms;                                         // Give up on a lookup after this long; 0 = wait forever (original behavior)
+    double hedge_percentile;                                 // Start a second attempt once the first has run longer than this percentile of observed latency; 0 = no hedging
+
+    pthread_mutex_t lock;                                    // Mutex lock for everything below
+    struct latency_histogram effective;                      // Latency the resolver actually saw (first answer, hedged or not, capped at the deadline)
+    struct latency_histogram first_attempt;                  // Latency of the first attempt alone, i.e. what we would have seen without hedging or deadlines
+    int hedges;                                              // Second attempts started
+    int hedge_wins;                                          // Lookups where the second attempt answered first
+    int timeouts;                                            // Lookups that hit the deadline
+    int outstanding;                                         // First attempts still running (abandoned ones included)
+    int attempts;                                            // Attempt threads still running, hedges and abandoned ones included; at most MAX_ATTEMPTS
+};
+
+// One connection in daemon mode (stdin/stdout, or one Unix socket client)
+// Every hostname a client sends holds a reference until its answer is queued, so a client that hangs up
+// with lookups still in the buffer is only closed once the last of them has been answered
+// Resolvers never write to the client themselves; they queue the answer and the client's own writer thread does the (possibly blocking) write
+struct daemon_client
+{
+    struct shared_variables *sv;                             // Pool this client feeds
+    FILE* in;                                                // Hostnames (and STATS requests) come in here
+    FILE* out;                                               // Answers go out here; only the writer thread touches it
+    int is_stdio;                                            // stdin/stdout client; never closed
+    int refs;                                                // Requester thread + names still in the buffer or being looked up
+    int finished;                                            // refs hit 0; writer drains the backlog, then closes the client
+    int dropped;                                             // Client fell CLIENT_BACKLOG answers behind or its socket failed; answers are thrown away
+    char* backlog[CLIENT_BACKLOG];                           // Ring of malloc'd answer lines waiting for the writer
+    int backlog_head;                                        // Next line to write
+    int backlog_count;                                       // Lines waiting
+    pthread_t writer;                                        // Writer thread; joined for the stdio client, detached otherwise
+    pthread_mutex_t lock;                                    // Mutex lock for everything above except in/out
+    pthread_cond_t has_output;                               // Signalled when a line is queued or the client is finished
+    pthread_cond_t has_room;                                 // Signalled when the writer takes a line; only the stdio client waits on it
+};
+
 // Struct example borrowed from lecture, modified with Assignment 6 conditional variables
 struct shared_variables
 {
@@ -49,6 +124,7 @@ struct shared_variables
     // Variables involved with thread process
     int count;                                               // Counts number of strings present in buffer; prevents trying to add more strings when buffer is full
     char shared_buffer[MAX_INPUT_FILES][MAX_NAME_LENGTH];    // Buffer, holds addresses to look up; 1025 is the string limit
+    struct daemon_client *shared_client[MAX_INPUT_FILES];    // Who to send each buffered address's answer to in daemon mode; NULL means the output file
     pthread_mutex_t buffer;                                  // Mutex lock for the buffer; any portion that adds/removes strings from the buffer uses this
     pthread_mutex_t results;                                 // Mutex lock for the results file; any portion that adds strings to the results file uses this
     int requesterDone;                                       // Flag for requester to trip when it's finished; prevents resolver from waiting forever for nonexistent requester to fill empty buffer
@@ -63,8 +139,31 @@ struct shared_variables
 
     // Conditional variables
     pthread_cond_t not_full, not_empty;                             // Conditional variable to replace mutex waiting loops when buffer is full/empty
+
+    // In-flight lookup table, so duplicate hostnames that show up close together only get looked up once
+    struct inflight_lookup inflight[MAX_INFLIGHT];
+    pthread_mutex_t inflight_lock;                           // Mutex lock for the in-flight table and the counters below
+    int lookups;                                             // Number of dnslookup calls actually made
+    int coalesced;                                           // Number of names answered by waiting on someone else's lookup
+
+    // Daemon mode stats; resolved is protected by the results lock
+    long resolved;                                           // Number of answers written out
+    struct timespec started;                                 // When the pool was started
+
+    // Overhead breakdown; each resolver adds its own totals in when it exits, under the results lock
+    int resolvers_done;                                      // Resolvers that have reported in
+    double buffer_time;                                      // Total time resolvers spent waiting on/taking from the bounded buffer
+    double write_time;                                       // Total time resolvers spent writing results
+    double lookup_min, lookup_sum, lookup_max;               // Per-resolver total lookup time across resolvers
+    double last_exit;                                        // When the last resolver finished (breakdown_now seconds)
 };
 
 // Member functions
 void *requester (void *shared_v);
 void *resolver (void *shared_v);
+void *daemon_requester (void *client_v);
+void *daemon_writer (void *client_v);
+void buffer_put (struct shared_variables *sv, const char *hostname, struct daemon_client *client);
+int coalesced_lookup (struct shared_variables *sv, const char *hostname, char *ipstr, int maxSize);
+int timed_lookup (const char *hostname, char *ipstr, int maxSize);
+void *lookup_attempt (void *group_v);